@@ -1,3 +1,4 @@
+#include <cstring>
 #include <set>
 
 #include "anonymize.h"
@@ -93,3 +94,63 @@ bool field_set::find(const string& table, const string& field)
     return this->fields.find(p) != this->fields.end();
 }
 
+
+/* *
+ * \brief Builds a tree of the fields listed for a table.
+ *
+ * Each field is a JSON pointer such as "/requester/firstName", and
+ * each path component (including array indices) becomes a node.
+ *
+ * \param[in] table Table name.
+ * \param[out] root Root of the tree, which is empty if no fields are
+ * listed for the table.
+ */
+void field_set::compile(const string& table, field_node* root) const
+{
+    *root = field_node();
+    for (auto it = fields.lower_bound(pair<string,string>(table, ""));
+            it != fields.end() && it->first == table; ++it) {
+        field_node* node = root;
+        const string& field = it->second;
+        size_t start = 0;
+        while (start < field.length()) {
+            if (field[start] == '/')
+                start++;
+            size_t end = field.find('/', start);
+            if (end == string::npos)
+                end = field.length();
+            string name = field.substr(start, end - start);
+            field_node* child = nullptr;
+            for (auto& c : node->children) {
+                if (c.name == name) {
+                    child = &c;
+                    break;
+                }
+            }
+            if (child == nullptr) {
+                node->children.push_back(field_node());
+                child = &(node->children.back());
+                child->name = name;
+            }
+            node = child;
+            start = end;
+        }
+        if (node != root)
+            node->match = true;
+    }
+}
+
+const field_node* field_node::find_child(const char* name, size_t length) const
+{
+    for (auto& c : children) {
+        if (c.name.length() == length &&
+                memcmp(c.name.data(), name, length) == 0)
+            return &c;
+    }
+    return nullptr;
+}
+
+bool field_node::empty() const
+{
+    return !match && children.empty();
+}
@@ -5,10 +5,24 @@
 
 #include "schema.h"
 
+/* *
+ * \brief Node in a tree of JSON pointer paths, used to match fields
+ * incrementally while descending into a record.
+ */
+class field_node {
+public:
+    string name;
+    bool match = false;
+    vector<field_node> children;
+    const field_node* find_child(const char* name, size_t length) const;
+    bool empty() const;
+};
+
 class field_set {
 public:
     set<pair<string,string>> fields;
     bool find(const string& table, const string& field);
+    void compile(const string& table, field_node* root) const;
 };
 
 void load_anonymize_field_list(field_set* drop_fields);
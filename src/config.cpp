@@ -61,6 +61,51 @@ const json::Value* ldp_config::get_json_pointer(const string& key) const
         return json::Pointer(key.c_str()).Get(jsondoc);
 }
 
+void ldp_config::get_string_list_map(
+        const string& key, map<string, vector<string>>* values) const
+{
+    values->clear();
+    const json::Value* v = get_json_pointer(key);
+    if (v == nullptr)
+        return;
+    if (v->IsObject() == false)
+        throw_invalid_data_type(key, "object");
+    // Loop through names, each with a JSON array of strings.
+    for (json::Value::ConstMemberIterator m = v->MemberBegin();
+            m != v->MemberEnd(); ++m) {
+        string name = m->name.GetString();
+        string name_key = key + "/" + name;
+        if (m->value.IsArray() == false)
+            throw_invalid_data_type(name_key, "array");
+        vector<string>& list = (*values)[name];
+        for (json::SizeType x = 0; x < m->value.Size(); x++) {
+            const json::Value& s = m->value[x];
+            if (s.IsString() == false)
+                throw_invalid_data_type(name_key + "/" + to_string(x),
+                                        "string");
+            list.push_back(s.GetString());
+        }
+    }
+}
+
+void ldp_config::get_string_map(const string& key,
+                                map<string, string>* values) const
+{
+    values->clear();
+    const json::Value* v = get_json_pointer(key);
+    if (v == nullptr)
+        return;
+    if (v->IsObject() == false)
+        throw_invalid_data_type(key, "object");
+    for (json::Value::ConstMemberIterator m = v->MemberBegin();
+            m != v->MemberEnd(); ++m) {
+        string name = m->name.GetString();
+        if (m->value.IsString() == false)
+            throw_invalid_data_type(key + "/" + name, "string");
+        (*values)[name] = m->value.GetString();
+    }
+}
+
 bool ldp_config::get_string(const string& key, bool required,
                             string* value) const
 {
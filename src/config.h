@@ -11,6 +11,9 @@ class ldp_config {
 public:
     ldp_config(const string& conf);
     void get_enable_sources(vector<data_source>* enable_sources) const;
+    void get_string_list_map(const string& key,
+                             map<string, vector<string>>* values) const;
+    void get_string_map(const string& key, map<string, string>* values) const;
     bool get_string(const string& key, bool required, string* value) const;
     bool get_int(const string& key, bool required, int* value) const;
     ///////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,85 @@
+#include <stdexcept>
+
+#include "copysender.h"
+
+copy_sender::copy_sender(etymon::pgconn* conn) :
+    conn(conn),
+    sender(&copy_sender::run, this) {}
+
+copy_sender::~copy_sender()
+{
+    stop();
+}
+
+/* *
+ * \brief Hands off a filled buffer to the sender thread.
+ *
+ * This waits for any previous buffer to be sent, and then swaps the
+ * buffers so that the caller receives the empty one (with its
+ * allocated capacity) to continue filling.
+ *
+ * \param[in,out] buffer The filled buffer, which is returned empty.
+ */
+void copy_sender::send(string* buffer)
+{
+    {
+        unique_lock<mutex> lock(mtx);
+        cv.wait(lock, [this] { return !pending; });
+        if (!error.empty())
+            throw runtime_error(error);
+        sending.swap(*buffer);
+        buffer->clear();
+        pending = true;
+    }
+    cv.notify_all();
+}
+
+/* *
+ * \brief Waits for all buffers to be sent and stops the sender thread.
+ *
+ * After this returns, the connection may be used again, e.g. to end
+ * the COPY.
+ */
+void copy_sender::finish()
+{
+    stop();
+    if (!error.empty())
+        throw runtime_error(error);
+}
+
+void copy_sender::stop()
+{
+    if (!sender.joinable())
+        return;
+    {
+        unique_lock<mutex> lock(mtx);
+        cv.wait(lock, [this] { return !pending; });
+        done = true;
+    }
+    cv.notify_all();
+    sender.join();
+}
+
+void copy_sender::run()
+{
+    unique_lock<mutex> lock(mtx);
+    while (true) {
+        cv.wait(lock, [this] { return pending || done; });
+        if (!pending)
+            return;
+        lock.unlock();
+        string err;
+        if (!sending.empty()) {
+            int r = PQputCopyData(conn->conn, sending.data(),
+                                  sending.length());
+            if (r == -1)
+                err = PQerrorMessage(conn->conn);
+        }
+        sending.clear();
+        lock.lock();
+        if (error.empty())
+            error = err;
+        pending = false;
+        cv.notify_all();
+    }
+}
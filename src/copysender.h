@@ -0,0 +1,40 @@
+#ifndef LDP_COPYSENDER_H
+#define LDP_COPYSENDER_H
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "../etymoncpp/include/postgres.h"
+
+using namespace std;
+
+/* *
+ * \brief Sends COPY data to the database on a separate thread.
+ *
+ * The parser fills one buffer while the sender thread transmits the
+ * other, so that JSON processing and network transfer overlap.  The
+ * connection must already be in the COPY IN state, and it must not be
+ * used by any other thread until finish() has returned.
+ */
+class copy_sender {
+public:
+    copy_sender(etymon::pgconn* conn);
+    ~copy_sender();
+    void send(string* buffer);
+    void finish();
+private:
+    void run();
+    void stop();
+    etymon::pgconn* conn;
+    string sending;
+    bool pending = false;
+    bool done = false;
+    string error;
+    mutex mtx;
+    condition_variable cv;
+    thread sender;
+};
+
+#endif
@@ -1,7 +1,13 @@
+#include <cstring>
 #include <stdexcept>
 
 #include "dbtype.h"
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define LDP_DBTYPE_X86
+#include <immintrin.h>
+#endif
+
 dbtype::dbtype(etymon::pgconn* conn)
 {
     string dbms_name;
@@ -38,6 +44,16 @@ const char* dbtype::json_type() const
     }
 }
 
+const char* dbtype::jsonb_type() const
+{
+    switch (dbt) {
+    case dbsys::postgresql:
+	return "JSONB";
+    default:
+	return json_type();
+    }
+}
+
 const char* dbtype::current_timestamp() const
 {
     switch (dbt) {
@@ -146,41 +162,143 @@ dbsys dbtype::type() const
     return dbt;
 }
 
-void dbtype::encode_copy(const char* str, string* newstr) const
+// Characters escaped in COPY text format are the backslash and the
+// control characters \b \t \n \v \f \r (8 through 13).  A null
+// character ends the string, as PostgreSQL text cannot contain it.
+// Each scanner returns a pointer to the first such character in
+// [p, end), or end if there is none.
+
+static inline bool is_copy_special(char c)
 {
-    newstr->clear();
-    const char *p = str;
-    char c;
-    while ( (c=*p) != '\0') {
-        switch (c) {
-            case '\\':
-                *newstr += "\\\\";
-                break;
+    return c == '\\' || c == '\0' || (c >= '\b' && c <= '\r');
+}
+
+static const char* scan_copy_scalar(const char* p, const char* end)
+{
+    while (p < end && !is_copy_special(*p))
+        p++;
+    return p;
+}
+
+#ifdef LDP_DBTYPE_X86
+
+static const char* scan_copy_sse2(const char* p, const char* end)
+{
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lo = _mm_set1_epi8('\b' - 1);
+    const __m128i hi = _mm_set1_epi8('\r' + 1);
+    while (end - p >= 16) {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i m = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(c, backslash),
+                             _mm_cmpeq_epi8(c, zero)),
+                _mm_and_si128(_mm_cmpgt_epi8(c, lo),
+                              _mm_cmplt_epi8(c, hi)));
+        int mask = _mm_movemask_epi8(m);
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    return scan_copy_scalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char* scan_copy_avx2(const char* p, const char* end)
+{
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i lo = _mm256_set1_epi8('\b' - 1);
+    const __m256i hi = _mm256_set1_epi8('\r' + 1);
+    while (end - p >= 32) {
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i m = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(c, backslash),
+                                _mm256_cmpeq_epi8(c, zero)),
+                _mm256_and_si256(_mm256_cmpgt_epi8(c, lo),
+                                 _mm256_cmpgt_epi8(hi, c)));
+        unsigned int mask = _mm256_movemask_epi8(m);
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return scan_copy_sse2(p, end);
+}
+
+#endif
+
+typedef const char* (*copy_scanner)(const char*, const char*);
+
+static copy_scanner select_copy_scanner()
+{
+#ifdef LDP_DBTYPE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return scan_copy_avx2;
+    return scan_copy_sse2;
+#else
+    return scan_copy_scalar;
+#endif
+}
+
+static const copy_scanner scan_copy = select_copy_scanner();
+
+/* *
+ * \brief Encodes a string in COPY text format, appending it to a
+ * buffer.
+ *
+ * Runs of characters that do not need escaping are found with vector
+ * instructions where available and copied to the buffer in bulk.
+ *
+ * \param[in] str The string to encode.
+ * \param[in] length Length of the string in bytes.
+ * \param[in,out] buffer The buffer to append to.
+ */
+void dbtype::encode_copy_append(const char* str, size_t length,
+                                string* buffer) const
+{
+    const char* p = str;
+    const char* end = str + length;
+    while (true) {
+        const char* q = scan_copy(p, end);
+        buffer->append(p, q - p);
+        if (q == end || *q == '\0')
+            return;
+        char e;
+        switch (*q) {
             case '\b':
-                *newstr += "\\b";
+                e = 'b';
                 break;
             case '\f':
-                *newstr += "\\f";
+                e = 'f';
                 break;
             case '\n':
-                *newstr += "\\n";
+                e = 'n';
                 break;
             case '\r':
-                *newstr += "\\r";
+                e = 'r';
                 break;
             case '\t':
-                *newstr += "\\t";
+                e = 't';
                 break;
             case '\v':
-                *newstr += "\\v";
+                e = 'v';
                 break;
             default:
-                *newstr += c;
+                e = *q;
         }
-        p++;
+        char escaped[2] = { '\\', e };
+        buffer->append(escaped, 2);
+        p = q + 1;
     }
 }
 
+void dbtype::encode_copy(const char* str, string* newstr) const
+{
+    newstr->clear();
+    encode_copy_append(str, strlen(str), newstr);
+}
+
 static void encode_str(const char* str, string* newstr, bool e)
 {
     if (e)
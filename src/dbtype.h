@@ -13,6 +13,7 @@ class dbtype {
 public:
     dbtype(etymon::pgconn* conn);
     const char* json_type() const;
+    const char* jsonb_type() const;
     const char* current_timestamp() const;
     void rename_sequence(const string& sequence_name,
         const string& new_sequence_name, string* sql) const;
@@ -23,6 +24,8 @@ public:
     void alter_sequence_owned_by(const string& sequence_name,
         const string& table_column_name, string* sql) const;
     void encode_copy(const char* str, string* newstr) const;
+    void encode_copy_append(const char* str, size_t length,
+            string* buffer) const;
     void encode_string_const(const char* str, string* newstr) const;
     const char* type_string() const;
     dbsys type() const;
@@ -1498,3 +1498,519 @@ void database_upgrade_27(database_upgrade_options* opt)
     ulog_commit(opt);
 }
 
+void database_upgrade_28(database_upgrade_options* opt)
+{
+    dbtype dbt(opt->conn);
+
+    { etymon::pgconn_result r(opt->conn, "BEGIN;"); }
+
+    string sql;
+    create_table_schemas_table_sql(dbt, &sql);
+    ulog_sql(sql, opt);
+    { etymon::pgconn_result r(opt->conn, sql); }
+
+    create_field_statistics_table_sql(dbt, &sql);
+    ulog_sql(sql, opt);
+    { etymon::pgconn_result r(opt->conn, sql); }
+
+    for (const char* table : {"dbsystem.table_schemas",
+                              "dbsystem.field_statistics"}) {
+        grant_select_on_table_sql(table, opt->ldp_user, opt->conn, &sql);
+        ulog_sql(sql, opt);
+        { etymon::pgconn_result r(opt->conn, sql); }
+        grant_select_on_table_sql(table, opt->ldpconfig_user, opt->conn,
+                                  &sql);
+        ulog_sql(sql, opt);
+        { etymon::pgconn_result r(opt->conn, sql); }
+    }
+
+    sql = "UPDATE dbsystem.main SET database_version = 28;";
+    ulog_sql(sql, opt);
+    { etymon::pgconn_result r(opt->conn, sql); }
+
+    { etymon::pgconn_result r(opt->conn, "COMMIT;"); }
+    ulog_commit(opt);
+}
+
+void database_upgrade_29(database_upgrade_options* opt)
+{
+    dbtype dbt(opt->conn);
+
+    { etymon::pgconn_result r(opt->conn, "BEGIN;"); }
+
+    string sql;
+    create_index_usage_table_sql(dbt, &sql);
+    ulog_sql(sql, opt);
+    { etymon::pgconn_result r(opt->conn, sql); }
+
+    grant_select_on_table_sql("dbsystem.index_usage", opt->ldp_user,
+                              opt->conn, &sql);
+    ulog_sql(sql, opt);
+    { etymon::pgconn_result r(opt->conn, sql); }
+    grant_select_on_table_sql("dbsystem.index_usage", opt->ldpconfig_user,
+                              opt->conn, &sql);
+    ulog_sql(sql, opt);
+    { etymon::pgconn_result r(opt->conn, sql); }
+
+    sql = "UPDATE dbsystem.main SET database_version = 29;";
+    ulog_sql(sql, opt);
+    { etymon::pgconn_result r(opt->conn, sql); }
+
+    { etymon::pgconn_result r(opt->conn, "COMMIT;"); }
+    ulog_commit(opt);
+}
+
+void database_upgrade_30(database_upgrade_options* opt)
+{
+    { etymon::pgconn_result r(opt->conn, "BEGIN;"); }
+
+    // Add a digest column to history tables.  Records already in
+    // history have no digest and are compared by data.  The column is
+    // indexed by the partial index on current versions that is created
+    // in upgrade 31.
+    string sql =
+        "SELECT t.table_name,\n"
+        "       EXISTS ( SELECT 1\n"
+        "                    FROM information_schema.columns AS c\n"
+        "                    WHERE c.table_schema = t.table_schema AND\n"
+        "                          c.table_name = t.table_name AND\n"
+        "                          c.column_name = 'digest' )\n"
+        "    FROM information_schema.tables AS t\n"
+        "    WHERE t.table_schema = 'history' AND\n"
+        "          t.table_type = 'BASE TABLE';";
+    ulog_sql(sql, opt);
+    vector<pair<string, bool>> tables;
+    {
+        etymon::pgconn_result r(opt->conn, sql);
+        for (int x = 0; x < PQntuples(r.result); x++)
+            tables.push_back({PQgetvalue(r.result, x, 0),
+                              string(PQgetvalue(r.result, x, 1)) == "t"});
+    }
+    for (const auto& [table, has_digest] : tables) {
+        if (!has_digest) {
+            sql =
+                "ALTER TABLE history." + table + "\n"
+                "    ADD COLUMN digest VARCHAR(32);";
+            ulog_sql(sql, opt);
+            { etymon::pgconn_result r(opt->conn, sql); }
+        }
+    }
+
+    sql = "UPDATE dbsystem.main SET database_version = 30;";
+    ulog_sql(sql, opt);
+    { etymon::pgconn_result r(opt->conn, sql); }
+
+    { etymon::pgconn_result r(opt->conn, "COMMIT;"); }
+    ulog_commit(opt);
+}
+
+void database_upgrade_31(database_upgrade_options* opt)
+{
+    dbtype dbt(opt->conn);
+
+    { etymon::pgconn_result r(opt->conn, "BEGIN;"); }
+
+    // Add an is_current column to history tables, and flag the latest
+    // version of each record.  The current versions are indexed on
+    // (id, digest); an index on all versions, which upgrade 30 created
+    // in development versions, is dropped if present.
+    string sql =
+        "SELECT t.table_name,\n"
+        "       EXISTS ( SELECT 1\n"
+        "                    FROM information_schema.columns AS c\n"
+        "                    WHERE c.table_schema = t.table_schema AND\n"
+        "                          c.table_name = t.table_name AND\n"
+        "                          c.column_name = 'is_current' )\n"
+        "    FROM information_schema.tables AS t\n"
+        "    WHERE t.table_schema = 'history' AND\n"
+        "          t.table_type = 'BASE TABLE';";
+    ulog_sql(sql, opt);
+    vector<pair<string, bool>> tables;
+    {
+        etymon::pgconn_result r(opt->conn, sql);
+        for (int x = 0; x < PQntuples(r.result); x++)
+            tables.push_back({PQgetvalue(r.result, x, 0),
+                              string(PQgetvalue(r.result, x, 1)) == "t"});
+    }
+    for (const auto& [table, has_current] : tables) {
+        if (!has_current) {
+            sql =
+                "ALTER TABLE history." + table + "\n"
+                "    ADD COLUMN is_current BOOLEAN NOT NULL DEFAULT FALSE;";
+            ulog_sql(sql, opt);
+            { etymon::pgconn_result r(opt->conn, sql); }
+            sql =
+                "UPDATE history." + table + " AS h\n"
+                "    SET is_current = TRUE\n"
+                "    FROM ( SELECT id, max(updated) AS updated\n"
+                "               FROM history." + table + "\n"
+                "               GROUP BY id ) AS l\n"
+                "    WHERE h.id = l.id AND\n"
+                "          h.updated = l.updated;";
+            ulog_sql(sql, opt);
+            { etymon::pgconn_result r(opt->conn, sql); }
+        }
+        if (dbt.type() == dbsys::postgresql) {
+            sql = "DROP INDEX IF EXISTS history.history_" + table +
+                "_id_digest_idx;";
+            ulog_sql(sql, opt);
+            { etymon::pgconn_result r(opt->conn, sql); }
+        }
+        create_history_current_index_sql(table, dbt, &sql);
+        if (!sql.empty()) {
+            ulog_sql(sql, opt);
+            { etymon::pgconn_result r(opt->conn, sql); }
+        }
+    }
+
+    sql = "UPDATE dbsystem.main SET database_version = 31;";
+    ulog_sql(sql, opt);
+    { etymon::pgconn_result r(opt->conn, sql); }
+
+    { etymon::pgconn_result r(opt->conn, "COMMIT;"); }
+    ulog_commit(opt);
+}
+
+static void partition_history_table(const string& table, const dbtype& dbt,
+                                    database_upgrade_options* opt)
+{
+    string old_table = table + "_unpartitioned";
+
+    { etymon::pgconn_result r(opt->conn, "BEGIN;"); }
+
+    string sql =
+        "ALTER TABLE history." + table + "\n"
+        "    RENAME TO " + old_table + ";";
+    ulog_sql(sql, opt);
+    { etymon::pgconn_result r(opt->conn, sql); }
+    sql =
+        "ALTER TABLE history." + old_table + "\n"
+        "    DROP CONSTRAINT history_" + table + "_pkey;";
+    ulog_sql(sql, opt);
+    { etymon::pgconn_result r(opt->conn, sql); }
+    sql = "DROP INDEX IF EXISTS history.history_" + table + "_current_idx;";
+    ulog_sql(sql, opt);
+    { etymon::pgconn_result r(opt->conn, sql); }
+
+    // The definition is fixed as of this version, and later columns are
+    // added by their own upgrades.
+    sql =
+        "CREATE TABLE history." + table + " (\n"
+        "    id VARCHAR(36) NOT NULL,\n"
+        "    data JSON NOT NULL,\n"
+        "    updated TIMESTAMP WITH TIME ZONE NOT NULL,\n"
+        "    digest VARCHAR(32),\n"
+        "    is_current BOOLEAN NOT NULL DEFAULT FALSE,\n"
+        "    CONSTRAINT\n"
+        "        history_" + table + "_pkey\n"
+        "        PRIMARY KEY (id, updated)\n"
+        ") PARTITION BY RANGE (updated);";
+    ulog_sql(sql, opt);
+    { etymon::pgconn_result r(opt->conn, sql); }
+    // Retain the data type, which may have been changed to JSONB.
+    sql =
+        "SELECT data_type\n"
+        "    FROM information_schema.columns\n"
+        "    WHERE table_schema = 'history' AND\n"
+        "          table_name = '" + old_table + "' AND\n"
+        "          column_name = 'data';";
+    ulog_sql(sql, opt);
+    string data_type;
+    {
+        etymon::pgconn_result r(opt->conn, sql);
+        data_type = PQgetvalue(r.result, 0, 0);
+    }
+    if (data_type == "jsonb") {
+        sql =
+            "ALTER TABLE history." + table + "\n"
+            "    ALTER COLUMN data TYPE " + data_type + ";";
+        ulog_sql(sql, opt);
+        { etymon::pgconn_result r(opt->conn, sql); }
+    }
+    create_history_default_partition_sql(table, dbt, &sql);
+    ulog_sql(sql, opt);
+    { etymon::pgconn_result r(opt->conn, sql); }
+
+    // Create a monthly partition for each month that has data.
+    sql =
+        "SELECT DISTINCT\n"
+        "       extract(year FROM updated AT TIME ZONE 'UTC'),\n"
+        "       extract(month FROM updated AT TIME ZONE 'UTC')\n"
+        "    FROM history." + old_table + ";";
+    ulog_sql(sql, opt);
+    vector<pair<int, int>> months;
+    {
+        etymon::pgconn_result r(opt->conn, sql);
+        for (int x = 0; x < PQntuples(r.result); x++)
+            months.push_back({stoi(PQgetvalue(r.result, x, 0)),
+                              stoi(PQgetvalue(r.result, x, 1))});
+    }
+    for (const auto& [year, month] : months) {
+        string partition;
+        create_history_partition_sql(table, year, month, 1, &partition,
+                                     &sql);
+        ulog_sql(sql, opt);
+        { etymon::pgconn_result r(opt->conn, sql); }
+    }
+
+    sql =
+        "INSERT INTO history." + table + "\n"
+        "    (id, data, updated, digest, is_current)\n"
+        "SELECT id, data, updated, digest, is_current\n"
+        "    FROM history." + old_table + ";";
+    ulog_sql(sql, opt);
+    { etymon::pgconn_result r(opt->conn, sql); }
+    sql = "DROP TABLE history." + old_table + ";";
+    ulog_sql(sql, opt);
+    { etymon::pgconn_result r(opt->conn, sql); }
+
+    grant_select_on_table_sql("history." + table, opt->ldp_user, opt->conn,
+                              &sql);
+    ulog_sql(sql, opt);
+    { etymon::pgconn_result r(opt->conn, sql); }
+    grant_select_on_table_sql("history." + table, opt->ldpconfig_user,
+                              opt->conn, &sql);
+    ulog_sql(sql, opt);
+    { etymon::pgconn_result r(opt->conn, sql); }
+    create_history_current_index_sql(table, dbt, &sql);
+    ulog_sql(sql, opt);
+    { etymon::pgconn_result r(opt->conn, sql); }
+
+    { etymon::pgconn_result r(opt->conn, "COMMIT;"); }
+    ulog_commit(opt);
+}
+
+void database_upgrade_32(database_upgrade_options* opt)
+{
+    dbtype dbt(opt->conn);
+
+    // Partition history tables by time of update.  Each table is
+    // converted in its own transaction, and tables that are already
+    // partitioned are only given a default partition.
+    if (dbt.type() == dbsys::postgresql) {
+        string sql =
+            "SELECT c.relname, c.relkind = 'p'\n"
+            "    FROM pg_class AS c\n"
+            "        JOIN pg_namespace AS n ON c.relnamespace = n.oid\n"
+            "    WHERE n.nspname = 'history' AND\n"
+            "          c.relkind IN ('r', 'p') AND\n"
+            "          NOT c.relispartition;";
+        ulog_sql(sql, opt);
+        vector<pair<string, bool>> tables;
+        {
+            etymon::pgconn_result r(opt->conn, sql);
+            for (int x = 0; x < PQntuples(r.result); x++)
+                tables.push_back({PQgetvalue(r.result, x, 0),
+                                  string(PQgetvalue(r.result, x, 1)) == "t"});
+        }
+        for (const auto& [table, partitioned] : tables) {
+            if (partitioned) {
+                create_history_default_partition_sql(table, dbt, &sql);
+                ulog_sql(sql, opt);
+                { etymon::pgconn_result r(opt->conn, sql); }
+                ulog_commit(opt);
+            } else {
+                partition_history_table(table, dbt, opt);
+            }
+        }
+    }
+
+    string sql = "UPDATE dbsystem.main SET database_version = 32;";
+    ulog_sql(sql, opt);
+    { etymon::pgconn_result r(opt->conn, sql); }
+    ulog_commit(opt);
+}
+
+void database_upgrade_33(database_upgrade_options* opt)
+{
+    dbtype dbt(opt->conn);
+
+    // Allow earlier versions of records to be stored as deltas, and
+    // create views that reconstruct them.
+    if (dbt.type() == dbsys::postgresql) {
+        { etymon::pgconn_result r(opt->conn, "BEGIN;"); }
+
+        string sql;
+        create_history_reconstruct_sql(dbt, &sql);
+        ulog_sql(sql, opt);
+        { etymon::pgconn_result r(opt->conn, sql); }
+
+        sql =
+            "SELECT c.relname\n"
+            "    FROM pg_class AS c\n"
+            "        JOIN pg_namespace AS n ON c.relnamespace = n.oid\n"
+            "    WHERE n.nspname = 'history' AND\n"
+            "          c.relkind IN ('r', 'p') AND\n"
+            "          NOT c.relispartition;";
+        ulog_sql(sql, opt);
+        vector<string> tables;
+        {
+            etymon::pgconn_result r(opt->conn, sql);
+            for (int x = 0; x < PQntuples(r.result); x++)
+                tables.push_back(PQgetvalue(r.result, x, 0));
+        }
+        for (const auto& table : tables) {
+            sql =
+                "ALTER TABLE history." + table + "\n"
+                "    ADD COLUMN IF NOT EXISTS delta JSONB,\n"
+                "    ALTER COLUMN data DROP NOT NULL;";
+            ulog_sql(sql, opt);
+            { etymon::pgconn_result r(opt->conn, sql); }
+            // The view is defined as of this version; later columns are
+            // added to it by their own upgrades.
+            sql =
+                "CREATE OR REPLACE VIEW\n"
+                "    history." + table + "_versions\n"
+                "    AS\n"
+                "SELECT id,\n"
+                "       updated,\n"
+                "       history.reconstruct(data::jsonb, delta)\n"
+                "           OVER (PARTITION BY id ORDER BY updated DESC) AS data,\n"
+                "       is_current\n"
+                "    FROM history." + table + ";";
+            ulog_sql(sql, opt);
+            { etymon::pgconn_result r(opt->conn, sql); }
+            string view = "history." + table + "_versions";
+            grant_select_on_table_sql(view, opt->ldp_user, opt->conn, &sql);
+            ulog_sql(sql, opt);
+            { etymon::pgconn_result r(opt->conn, sql); }
+            grant_select_on_table_sql(view, opt->ldpconfig_user, opt->conn,
+                                      &sql);
+            ulog_sql(sql, opt);
+            { etymon::pgconn_result r(opt->conn, sql); }
+        }
+
+        { etymon::pgconn_result r(opt->conn, "COMMIT;"); }
+        ulog_commit(opt);
+    }
+
+    string sql = "UPDATE dbsystem.main SET database_version = 33;";
+    ulog_sql(sql, opt);
+    { etymon::pgconn_result r(opt->conn, sql); }
+    ulog_commit(opt);
+}
+
+void database_upgrade_34(database_upgrade_options* opt)
+{
+    { etymon::pgconn_result r(opt->conn, "BEGIN;"); }
+
+    string sql =
+        "ALTER TABLE dbsystem.tables\n"
+        "    ADD COLUMN fingerprint VARCHAR(128);";
+    ulog_sql(sql, opt);
+    { etymon::pgconn_result r(opt->conn, sql); }
+
+    sql =
+        "ALTER TABLE dbsystem.tables\n"
+        "    ADD COLUMN unchanged BOOLEAN;";
+    ulog_sql(sql, opt);
+    { etymon::pgconn_result r(opt->conn, sql); }
+
+    sql = "UPDATE dbsystem.main SET database_version = 34;";
+    ulog_sql(sql, opt);
+    { etymon::pgconn_result r(opt->conn, sql); }
+
+    { etymon::pgconn_result r(opt->conn, "COMMIT;"); }
+    ulog_commit(opt);
+}
+
+void database_upgrade_35(database_upgrade_options* opt)
+{
+    dbtype dbt(opt->conn);
+
+    { etymon::pgconn_result r(opt->conn, "BEGIN;"); }
+
+    // Add a deleted column to history tables for tombstones.  In
+    // PostgreSQL the column is added to partitioned tables, which adds
+    // it to their partitions.  Tables created by earlier upgrades with
+    // the current definition already have the column.
+    string exists =
+        "EXISTS ( SELECT 1\n"
+        "                    FROM information_schema.columns AS col\n"
+        "                    WHERE col.table_schema = 'history' AND\n"
+        "                          col.table_name = ";
+    string sql;
+    if (dbt.type() == dbsys::postgresql) {
+        sql =
+            "SELECT c.relname,\n"
+            "       " + exists + "c.relname AND\n"
+            "                          col.column_name = 'deleted' )\n"
+            "    FROM pg_class AS c\n"
+            "        JOIN pg_namespace AS n ON c.relnamespace = n.oid\n"
+            "    WHERE n.nspname = 'history' AND\n"
+            "          c.relkind IN ('r', 'p') AND\n"
+            "          NOT c.relispartition;";
+    } else {
+        sql =
+            "SELECT t.table_name,\n"
+            "       " + exists + "t.table_name AND\n"
+            "                          col.column_name = 'deleted' )\n"
+            "    FROM information_schema.tables AS t\n"
+            "    WHERE t.table_schema = 'history' AND\n"
+            "          t.table_type = 'BASE TABLE';";
+    }
+    ulog_sql(sql, opt);
+    vector<pair<string, bool>> tables;
+    {
+        etymon::pgconn_result r(opt->conn, sql);
+        for (int x = 0; x < PQntuples(r.result); x++)
+            tables.push_back({PQgetvalue(r.result, x, 0),
+                              string(PQgetvalue(r.result, x, 1)) == "t"});
+    }
+    for (const auto& [table, has_deleted] : tables) {
+        if (!has_deleted) {
+            sql =
+                "ALTER TABLE history." + table + "\n"
+                "    ADD COLUMN deleted BOOLEAN NOT NULL DEFAULT FALSE;";
+            ulog_sql(sql, opt);
+            { etymon::pgconn_result r(opt->conn, sql); }
+        }
+        // The view of versions is extended with the new column.
+        create_history_versions_view_sql(table, dbt, &sql);
+        if (!sql.empty()) {
+            ulog_sql(sql, opt);
+            { etymon::pgconn_result r(opt->conn, sql); }
+        }
+    }
+
+    sql = "UPDATE dbsystem.main SET database_version = 35;";
+    ulog_sql(sql, opt);
+    { etymon::pgconn_result r(opt->conn, sql); }
+
+    { etymon::pgconn_result r(opt->conn, "COMMIT;"); }
+    ulog_commit(opt);
+}
+
+void database_upgrade_36(database_upgrade_options* opt)
+{
+    dbtype dbt(opt->conn);
+
+    { etymon::pgconn_result r(opt->conn, "BEGIN;"); }
+
+    string sql;
+    create_foreign_key_checks_table_sql(dbt, &sql);
+    ulog_sql(sql, opt);
+    { etymon::pgconn_result r(opt->conn, sql); }
+
+    create_foreign_key_exceptions_table_sql(dbt, &sql);
+    ulog_sql(sql, opt);
+    { etymon::pgconn_result r(opt->conn, sql); }
+
+    for (const char* table : {"dbsystem.foreign_key_checks",
+                              "dbsystem.foreign_key_exceptions"}) {
+        grant_select_on_table_sql(table, opt->ldp_user, opt->conn, &sql);
+        ulog_sql(sql, opt);
+        { etymon::pgconn_result r(opt->conn, sql); }
+        grant_select_on_table_sql(table, opt->ldpconfig_user, opt->conn,
+                                  &sql);
+        ulog_sql(sql, opt);
+        { etymon::pgconn_result r(opt->conn, sql); }
+    }
+
+    sql = "UPDATE dbsystem.main SET database_version = 36;";
+    ulog_sql(sql, opt);
+    { etymon::pgconn_result r(opt->conn, sql); }
+
+    { etymon::pgconn_result r(opt->conn, "COMMIT;"); }
+    ulog_commit(opt);
+}
@@ -0,0 +1,162 @@
+#include <cstring>
+
+#include "digest.h"
+
+// MD5 as specified in RFC 1321.
+
+static const uint32_t md5_k[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+    0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+    0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+    0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+    0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+    0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+    0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+    0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+    0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const int md5_r[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+static inline uint32_t rotate_left(uint32_t x, int c)
+{
+    return (x << c) | (x >> (32 - c));
+}
+
+void record_digest::reset()
+{
+    state[0] = 0x67452301;
+    state[1] = 0xefcdab89;
+    state[2] = 0x98badcfe;
+    state[3] = 0x10325476;
+    processed_length = 0;
+    block_length = 0;
+}
+
+void record_digest::process_block()
+{
+    uint32_t m[16];
+    for (int x = 0; x < 16; x++) {
+        m[x] = (uint32_t) block[x * 4] |
+            ((uint32_t) block[x * 4 + 1] << 8) |
+            ((uint32_t) block[x * 4 + 2] << 16) |
+            ((uint32_t) block[x * 4 + 3] << 24);
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    for (int x = 0; x < 64; x++) {
+        uint32_t f;
+        int g;
+        if (x < 16) {
+            f = (b & c) | (~b & d);
+            g = x;
+        } else if (x < 32) {
+            f = (d & b) | (~d & c);
+            g = (5 * x + 1) % 16;
+        } else if (x < 48) {
+            f = b ^ c ^ d;
+            g = (3 * x + 5) % 16;
+        } else {
+            f = c ^ (b | ~d);
+            g = (7 * x) % 16;
+        }
+        uint32_t t = d;
+        d = c;
+        c = b;
+        b = b + rotate_left(a + f + md5_k[x] + m[g], md5_r[x]);
+        a = t;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    processed_length += sizeof block;
+    block_length = 0;
+}
+
+void record_digest::update(const char* data, size_t length)
+{
+    while (length > 0) {
+        size_t n = sizeof block - block_length;
+        if (n > length)
+            n = length;
+        memcpy(block + block_length, data, n);
+        block_length += n;
+        data += n;
+        length -= n;
+        if (block_length == sizeof block)
+            process_block();
+    }
+}
+
+/* *
+ * \brief Completes the digest and writes it as 16 bytes.
+ *
+ * The digest must be reset before it is reused.
+ */
+void record_digest::finish(uint8_t* digest)
+{
+    uint64_t bits = (processed_length + block_length) * 8;
+    put((char) 0x80);
+    while (block_length != 56)
+        put(0);
+    for (int x = 0; x < 8; x++)
+        put((char) (bits >> (x * 8)));
+    for (int x = 0; x < 4; x++) {
+        for (int y = 0; y < 4; y++)
+            digest[x * 4 + y] = (uint8_t) (state[x] >> (y * 8));
+    }
+}
+
+static const char hex_digits[] = "0123456789abcdef";
+
+/* *
+ * \brief Completes the digest and writes it as 32 hexadecimal digits.
+ */
+void record_digest::finish(string* hex)
+{
+    uint8_t digest[16];
+    finish(digest);
+    hex->clear();
+    for (uint8_t byte : digest) {
+        *hex += hex_digits[byte >> 4];
+        *hex += hex_digits[byte & 0x0f];
+    }
+}
+
+void table_fingerprint::add(const uint8_t* digest)
+{
+    uint64_t low = 0, high = 0;
+    for (int x = 0; x < 8; x++) {
+        low |= (uint64_t) digest[x] << (x * 8);
+        high |= (uint64_t) digest[x + 8] << (x * 8);
+    }
+    sum[0] += low;
+    sum[1] += high + (sum[0] < low ? 1 : 0);
+    count++;
+}
+
+/* *
+ * \brief Writes the fingerprint as the sum of the digests in 32
+ * hexadecimal digits, followed by ':' and the number of records.
+ */
+void table_fingerprint::finish(string* str) const
+{
+    str->clear();
+    for (int x = 1; x >= 0; x--) {
+        for (int shift = 60; shift >= 0; shift -= 4)
+            *str += hex_digits[(sum[x] >> shift) & 0x0f];
+    }
+    *str += ':' + to_string(count);
+}
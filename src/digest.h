@@ -0,0 +1,53 @@
+#ifndef LDP_DIGEST_H
+#define LDP_DIGEST_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+/* *
+ * \brief Incremental MD5 digest of a record.
+ *
+ * The digest is used only to detect changed records, and the
+ * hexadecimal form matches the md5() function in the database, so that
+ * digests of stored data can be computed in SQL.
+ */
+class record_digest {
+public:
+    record_digest() { reset(); }
+    void reset();
+    void put(char c) {
+        block[block_length++] = (uint8_t) c;
+        if (block_length == sizeof block)
+            process_block();
+    }
+    void update(const char* data, size_t length);
+    void finish(uint8_t* digest);
+    void finish(string* hex);
+private:
+    uint32_t state[4];
+    uint64_t processed_length;
+    uint8_t block[64];
+    size_t block_length;
+    void process_block();
+};
+
+/* *
+ * \brief Order-independent combination of the digests of the records
+ * in a table.
+ *
+ * The digests are added as 128-bit integers, so that the result does
+ * not depend on the order in which records are read.
+ */
+class table_fingerprint {
+public:
+    void add(const uint8_t* digest);
+    void finish(string* str) const;
+private:
+    uint64_t sum[2] = {0, 0};
+    uint64_t count = 0;
+};
+
+#endif
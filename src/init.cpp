@@ -14,7 +14,7 @@
 
 namespace fs = std::experimental::filesystem;
 
-static int64_t ldp_latest_database_version = 27;
+static int64_t ldp_latest_database_version = 36;
 
 database_upgrade_array database_upgrades[] = {
     nullptr,  // Version 0 has no migration.
@@ -44,7 +44,16 @@ database_upgrade_array database_upgrades[] = {
     database_upgrade_24,
     database_upgrade_25,
     database_upgrade_26,
-    database_upgrade_27
+    database_upgrade_27,
+    database_upgrade_28,
+    database_upgrade_29,
+    database_upgrade_30,
+    database_upgrade_31,
+    database_upgrade_32,
+    database_upgrade_33,
+    database_upgrade_34,
+    database_upgrade_35,
+    database_upgrade_36
 };
 
 int64_t latest_database_version()
@@ -187,7 +196,9 @@ static void init_database_all(etymon::pgconn* conn, const string& ldp_user,
         "    row_count BIGINT,\n"
         "    history_row_count BIGINT,\n"
         "    documentation VARCHAR(65535),\n"
-        "    documentation_url VARCHAR(65535)\n"
+        "    documentation_url VARCHAR(65535),\n"
+        "    fingerprint VARCHAR(128),\n"
+        "    unchanged BOOLEAN\n"
         ");";
     { etymon::pgconn_result r(conn, sql); }
     // Add tables to the catalog.
@@ -222,6 +233,21 @@ static void init_database_all(etymon::pgconn* conn, const string& ldp_user,
         ")" + rskeys + ";";
     { etymon::pgconn_result r(conn, sql); }
 
+    create_table_schemas_table_sql(dbt, &sql);
+    { etymon::pgconn_result r(conn, sql); }
+
+    create_field_statistics_table_sql(dbt, &sql);
+    { etymon::pgconn_result r(conn, sql); }
+
+    create_index_usage_table_sql(dbt, &sql);
+    { etymon::pgconn_result r(conn, sql); }
+
+    create_foreign_key_checks_table_sql(dbt, &sql);
+    { etymon::pgconn_result r(conn, sql); }
+
+    create_foreign_key_exceptions_table_sql(dbt, &sql);
+    { etymon::pgconn_result r(conn, sql); }
+
     //sql = "GRANT SELECT ON ALL TABLES IN SCHEMA dbsystem TO " + ldp_user + ";";
     //{ etymon::pgconn_result r(conn, sql); }
     //sql = "GRANT SELECT ON ALL TABLES IN SCHEMA dbsystem TO " +
@@ -252,6 +278,17 @@ static void init_database_all(etymon::pgconn* conn, const string& ldp_user,
     sql = "GRANT SELECT ON dbsystem.tables TO " + ldpconfig_user + ";";
     { etymon::pgconn_result r(conn, sql); }
 
+    for (const char* table : {"dbsystem.table_schemas",
+                              "dbsystem.field_statistics",
+                              "dbsystem.index_usage",
+                              "dbsystem.foreign_key_checks",
+                              "dbsystem.foreign_key_exceptions"}) {
+        grant_select_on_table_sql(table, ldp_user, conn, &sql);
+        { etymon::pgconn_result r(conn, sql); }
+        grant_select_on_table_sql(table, ldpconfig_user, conn, &sql);
+        { etymon::pgconn_result r(conn, sql); }
+    }
+
     // Schema: dbconfig
 
     sql = "CREATE SCHEMA dbconfig;";
@@ -316,9 +353,31 @@ static void init_database_all(etymon::pgconn* conn, const string& ldp_user,
     sql = "GRANT USAGE ON SCHEMA history TO " + ldpconfig_user + ";";
     { etymon::pgconn_result r(conn, sql); }
 
+    create_history_reconstruct_sql(dbt, &sql);
+    if (!sql.empty()) {
+        etymon::pgconn_result r(conn, sql);
+    }
+
     for (auto& table : schema.tables) {
         create_history_table_sql(table.name, conn, dbt, &sql);
         { etymon::pgconn_result r(conn, sql); }
+        create_history_default_partition_sql(table.name, dbt, &sql);
+        if (!sql.empty()) {
+            etymon::pgconn_result r(conn, sql);
+        }
+        create_history_current_index_sql(table.name, dbt, &sql);
+        if (!sql.empty()) {
+            etymon::pgconn_result r(conn, sql);
+        }
+        create_history_versions_view_sql(table.name, dbt, &sql);
+        if (!sql.empty()) {
+            { etymon::pgconn_result r(conn, sql); }
+            string view = "history." + table.name + "_versions";
+            grant_select_on_table_sql(view, ldp_user, conn, &sql);
+            { etymon::pgconn_result r(conn, sql); }
+            grant_select_on_table_sql(view, ldpconfig_user, conn, &sql);
+            { etymon::pgconn_result r(conn, sql); }
+        }
         grant_select_on_table_sql("history." + table.name, ldp_user,
                                   conn, &sql);
         { etymon::pgconn_result r(conn, sql); }
@@ -1,3 +1,5 @@
+#include <cstdio>
+
 #include "initutil.h"
 
 void create_main_table_sql(const string& table_name, etymon::pgconn* conn,
@@ -19,15 +21,248 @@ void create_history_table_sql(const string& table_name,
 {
     string rskeys;
     dbt.redshift_keys("id", "id, updated", &rskeys);
+    // In PostgreSQL, history is partitioned by time of update, and
+    // earlier versions may be stored as deltas in place of data.
+    string data_null = " NOT NULL";
+    string delta;
+    string partition;
+    if (dbt.type() == dbsys::postgresql) {
+        data_null = "";
+        delta = "    delta JSONB,\n";
+        partition = " PARTITION BY RANGE (updated)";
+    }
     *sql =
         "CREATE TABLE IF NOT EXISTS\n"
         "    history." + table_name + " (\n"
         "    id VARCHAR(36) NOT NULL,\n"
-        "    data " + dbt.json_type() + " NOT NULL,\n"
+        "    data " + dbt.json_type() + data_null + ",\n"
         "    updated TIMESTAMP WITH TIME ZONE NOT NULL,\n"
+        "    digest VARCHAR(32),\n"
+        "    is_current BOOLEAN NOT NULL DEFAULT FALSE,\n"
+        "    deleted BOOLEAN NOT NULL DEFAULT FALSE,\n" + delta +
         "    CONSTRAINT\n"
         "        history_" + table_name + "_pkey\n"
         "        PRIMARY KEY (id, updated)\n"
+        ")" + partition + rskeys + ";";
+}
+
+/* *
+ * \brief Returns SQL that creates the default partition of a history
+ * table, which holds rows outside of the time-range partitions, or an
+ * empty string if partitioning is not supported.
+ */
+void create_history_default_partition_sql(const string& table_name,
+                                          const dbtype& dbt, string* sql)
+{
+    if (dbt.type() != dbsys::postgresql) {
+        sql->clear();
+        return;
+    }
+    *sql =
+        "CREATE TABLE IF NOT EXISTS\n"
+        "    history." + table_name + "_default\n"
+        "    PARTITION OF history." + table_name + " DEFAULT;";
+}
+
+/* *
+ * \brief Returns SQL that creates the function and aggregate used to
+ * reconstruct versions of records stored as deltas, or an empty string
+ * if deltas are not supported.
+ *
+ * A delta has the form {"set": {...}, "unset": [...]}, and it is
+ * applied to the following version of the record to obtain the earlier
+ * version.  A row with data is taken as is.
+ */
+void create_history_reconstruct_sql(const dbtype& dbt, string* sql)
+{
+    if (dbt.type() != dbsys::postgresql) {
+        sql->clear();
+        return;
+    }
+    *sql =
+        "CREATE OR REPLACE FUNCTION\n"
+        "    history.apply_delta(state JSONB, data JSONB, delta JSONB)\n"
+        "    RETURNS JSONB\n"
+        "    LANGUAGE SQL IMMUTABLE\n"
+        "    AS $$\n"
+        "SELECT CASE WHEN data IS NOT NULL THEN data\n"
+        "            ELSE (state || (delta->'set')) -\n"
+        "                 ARRAY(SELECT jsonb_array_elements_text(delta->'unset'))\n"
+        "       END\n"
+        "$$;\n"
+        "CREATE OR REPLACE AGGREGATE\n"
+        "    history.reconstruct(JSONB, JSONB) (\n"
+        "    SFUNC = history.apply_delta,\n"
+        "    STYPE = JSONB\n"
+        ");";
+}
+
+/* *
+ * \brief Returns SQL that creates a view of a history table with every
+ * version reconstructed, or an empty string if deltas are not
+ * supported.
+ */
+void create_history_versions_view_sql(const string& table_name,
+                                      const dbtype& dbt, string* sql)
+{
+    if (dbt.type() != dbsys::postgresql) {
+        sql->clear();
+        return;
+    }
+    *sql =
+        "CREATE OR REPLACE VIEW\n"
+        "    history." + table_name + "_versions\n"
+        "    AS\n"
+        "SELECT id,\n"
+        "       updated,\n"
+        "       history.reconstruct(data::jsonb, delta)\n"
+        "           OVER (PARTITION BY id ORDER BY updated DESC) AS data,\n"
+        "       is_current,\n"
+        "       deleted\n"
+        "    FROM history." + table_name + ";";
+}
+
+static string utc_month_start(int month_index)
+{
+    char s[32];
+    snprintf(s, sizeof s, "%04d-%02d-01 00:00:00+00", month_index / 12,
+             month_index % 12 + 1);
+    return s;
+}
+
+/* *
+ * \brief Returns SQL that creates a partition of a history table for
+ * the given number of months, starting in the given year and month
+ * (UTC).  The partition is named with the suffix _pYYYYMM.
+ */
+void create_history_partition_sql(const string& table_name, int year,
+                                  int month, int months, string* partition,
+                                  string* sql)
+{
+    int start = year * 12 + (month - 1);
+    char suffix[16];
+    snprintf(suffix, sizeof suffix, "_p%04d%02d", year, month);
+    *partition = "history." + table_name + suffix;
+    *sql =
+        "CREATE TABLE " + *partition + "\n"
+        "    PARTITION OF history." + table_name + "\n"
+        "    FOR VALUES FROM ('" + utc_month_start(start) + "')\n"
+        "               TO ('" + utc_month_start(start + months) + "');";
+}
+
+/* *
+ * \brief Returns SQL that creates a partial index on the current
+ * versions of records in a history table, or an empty string if
+ * indexes are not supported.
+ */
+void create_history_current_index_sql(const string& table_name,
+                                      const dbtype& dbt, string* sql)
+{
+    if (dbt.type() != dbsys::postgresql) {
+        sql->clear();
+        return;
+    }
+    *sql =
+        "CREATE INDEX IF NOT EXISTS\n"
+        "    history_" + table_name + "_current_idx\n"
+        "    ON history." + table_name + " (id, digest)\n"
+        "    WHERE is_current;";
+}
+
+void create_table_schemas_table_sql(const dbtype& dbt, string* sql)
+{
+    string rskeys;
+    dbt.redshift_keys("table_name", "table_name, schema_hash", &rskeys);
+    *sql =
+        "CREATE TABLE dbsystem.table_schemas (\n"
+        "    table_name VARCHAR(63) NOT NULL,\n"
+        "    schema_hash VARCHAR(16) NOT NULL,\n"
+        "    columns VARCHAR(65535) NOT NULL,\n"
+        "    first_seen TIMESTAMP WITH TIME ZONE NOT NULL,\n"
+        "    last_seen TIMESTAMP WITH TIME ZONE NOT NULL,\n"
+        "        PRIMARY KEY (table_name, schema_hash)\n"
+        ")" + rskeys + ";";
+}
+
+void create_field_statistics_table_sql(const dbtype& dbt, string* sql)
+{
+    string rskeys;
+    dbt.redshift_keys("table_name", "table_name, field_name", &rskeys);
+    *sql =
+        "CREATE TABLE dbsystem.field_statistics (\n"
+        "    table_name VARCHAR(63) NOT NULL,\n"
+        "    field_name VARCHAR(65535) NOT NULL,\n"
+        "    column_name VARCHAR(65535) NOT NULL,\n"
+        "    column_type VARCHAR(63) NOT NULL,\n"
+        "    schema_hash VARCHAR(16) NOT NULL,\n"
+        "    string_count BIGINT NOT NULL,\n"
+        "    date_time_count BIGINT NOT NULL,\n"
+        "    number_count BIGINT NOT NULL,\n"
+        "    integer_count BIGINT NOT NULL,\n"
+        "    floating_count BIGINT NOT NULL,\n"
+        "    boolean_count BIGINT NOT NULL,\n"
+        "    null_count BIGINT NOT NULL,\n"
+        "    uuid_count BIGINT NOT NULL,\n"
+        "    max_length BIGINT NOT NULL,\n"
+        "    updated TIMESTAMP WITH TIME ZONE NOT NULL,\n"
+        "        PRIMARY KEY (table_name, field_name)\n"
+        ")" + rskeys + ";";
+}
+
+void create_index_usage_table_sql(const dbtype& dbt, string* sql)
+{
+    string rskeys;
+    dbt.redshift_keys("table_name", "table_name, column_name", &rskeys);
+    *sql =
+        "CREATE TABLE dbsystem.index_usage (\n"
+        "    table_name VARCHAR(63) NOT NULL,\n"
+        "    column_name VARCHAR(63) NOT NULL,\n"
+        "    index_scans BIGINT NOT NULL,\n"
+        "    unused_updates INTEGER NOT NULL,\n"
+        "    updated TIMESTAMP WITH TIME ZONE NOT NULL,\n"
+        "        PRIMARY KEY (table_name, column_name)\n"
+        ")" + rskeys + ";";
+}
+
+/* *
+ * \brief Returns SQL that creates the table of foreign keys that were
+ * checked, which allows the results to be reused while the referencing
+ * and referenced tables are unchanged.
+ */
+void create_foreign_key_checks_table_sql(const dbtype& dbt, string* sql)
+{
+    string rskeys;
+    dbt.redshift_keys("referencing_table",
+            "referencing_table, referencing_column", &rskeys);
+    *sql =
+        "CREATE TABLE dbsystem.foreign_key_checks (\n"
+        "    referencing_table VARCHAR(63) NOT NULL,\n"
+        "    referencing_column VARCHAR(63) NOT NULL,\n"
+        "    referenced_table VARCHAR(63) NOT NULL,\n"
+        "    referenced_column VARCHAR(63) NOT NULL,\n"
+        "    forced BOOLEAN NOT NULL,\n"
+        "    exception_count BIGINT NOT NULL,\n"
+        "    checked TIMESTAMP WITH TIME ZONE NOT NULL\n"
+        ")" + rskeys + ";";
+}
+
+/* *
+ * \brief Returns SQL that creates the table of foreign keys found not
+ * to be present in the referenced table when last checked.
+ */
+void create_foreign_key_exceptions_table_sql(const dbtype& dbt, string* sql)
+{
+    string rskeys;
+    dbt.redshift_keys("referencing_table",
+            "referencing_table, referencing_column", &rskeys);
+    *sql =
+        "CREATE TABLE dbsystem.foreign_key_exceptions (\n"
+        "    referencing_table VARCHAR(63) NOT NULL,\n"
+        "    referencing_column VARCHAR(63) NOT NULL,\n"
+        "    referenced_table VARCHAR(63) NOT NULL,\n"
+        "    referenced_column VARCHAR(63) NOT NULL,\n"
+        "    referencing_pkey VARCHAR(65535) NOT NULL,\n"
+        "    referencing_fkey VARCHAR(65535) NOT NULL\n"
         ")" + rskeys + ";";
 }
 
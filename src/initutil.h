@@ -15,6 +15,30 @@ void create_history_table_sql(const string& table_name,
                               etymon::pgconn* conn, const dbtype& dbt,
                               string* sql);
 
+void create_history_default_partition_sql(const string& table_name,
+                                          const dbtype& dbt, string* sql);
+
+void create_history_partition_sql(const string& table_name, int year,
+                                  int month, int months, string* partition,
+                                  string* sql);
+
+void create_history_reconstruct_sql(const dbtype& dbt, string* sql);
+
+void create_history_versions_view_sql(const string& table_name,
+                                      const dbtype& dbt, string* sql);
+
+void create_history_current_index_sql(const string& table_name,
+                                      const dbtype& dbt, string* sql);
+
+void create_table_schemas_table_sql(const dbtype& dbt, string* sql);
+
+void create_field_statistics_table_sql(const dbtype& dbt, string* sql);
+
+void create_index_usage_table_sql(const dbtype& dbt, string* sql);
+void create_foreign_key_checks_table_sql(const dbtype& dbt, string* sql);
+void create_foreign_key_exceptions_table_sql(const dbtype& dbt,
+                                             string* sql);
+
 void grant_select_on_table_sql(const string& table, const string& user,
                                etymon::pgconn* conn, string* sql);
 
@@ -363,6 +363,118 @@ void config_options(const ldp_config& conf, ldp_options* opt)
 
     conf.get_bool("/record_history", &(opt->record_history));
 
+    conf.get_bool("/compact_json", &(opt->compact_json));
+
+    int sample_percent = 0;
+    if (conf.get_int("/analyze_sample_percent", false, &sample_percent)) {
+        if (1 <= sample_percent && sample_percent <= 100) {
+            opt->analyze_sample_percent = sample_percent;
+        } else {
+            throw_value_out_of_range("/analyze_sample_percent",
+                                     to_string(sample_percent), "1 to 100");
+        }
+    }
+
+    int index_connections = 0;
+    if (conf.get_int("/index_connections", false, &index_connections)) {
+        if (1 <= index_connections && index_connections <= 64) {
+            opt->index_connections = index_connections;
+        } else {
+            throw_value_out_of_range("/index_connections",
+                                     to_string(index_connections), "1 to 64");
+        }
+    }
+
+    conf.get_bool("/unlogged_loading_tables",
+                  &(opt->unlogged_loading_tables));
+    conf.get_bool("/keep_tables_unlogged", &(opt->keep_tables_unlogged));
+    conf.get_string_map("/session_settings", &(opt->session_settings));
+
+    conf.get_bool("/jsonb", &(opt->jsonb));
+    conf.get_string_list_map("/jsonb_indexes", &(opt->jsonb_indexes));
+
+    string history_storage;
+    if (conf.get_string("/history_storage", false, &history_storage)) {
+        if (history_storage == "full") {
+            opt->history_deltas = false;
+        } else if (history_storage == "delta") {
+            opt->history_deltas = true;
+        } else {
+            throw_value_out_of_range("/history_storage", history_storage,
+                                     "full, delta");
+        }
+    }
+    if (opt->history_deltas && !opt->jsonb) {
+        throw runtime_error(
+            "The configuration setting \"history_storage\": \"delta\"\n"
+            "requires \"jsonb\" to be enabled.");
+    }
+
+    string index_policy;
+    if (conf.get_string("/index_policy", false, &index_policy)) {
+        if (index_policy == "all") {
+            opt->advise_indexes = false;
+        } else if (index_policy == "advised") {
+            opt->advise_indexes = true;
+        } else {
+            throw_value_out_of_range("/index_policy", index_policy,
+                                     "all, advised");
+        }
+    }
+    conf.get_string_list_map("/index_columns", &(opt->index_columns));
+    conf.get_string_list_map("/no_index_columns", &(opt->no_index_columns));
+    int partition_months = 0;
+    if (conf.get_int("/history_partition_months", false,
+                     &partition_months)) {
+        if (1 <= partition_months && partition_months <= 120) {
+            opt->history_partition_months = partition_months;
+        } else {
+            throw_value_out_of_range("/history_partition_months",
+                                     to_string(partition_months),
+                                     "1 to 120");
+        }
+    }
+    int foreign_key_connections = 0;
+    if (conf.get_int("/foreign_key_connections", false,
+                     &foreign_key_connections)) {
+        if (1 <= foreign_key_connections && foreign_key_connections <= 64) {
+            opt->foreign_key_connections = foreign_key_connections;
+        } else {
+            throw_value_out_of_range("/foreign_key_connections",
+                                     to_string(foreign_key_connections),
+                                     "1 to 64");
+        }
+    }
+    int maintenance_connections = 0;
+    if (conf.get_int("/maintenance_connections", false,
+                     &maintenance_connections)) {
+        if (1 <= maintenance_connections && maintenance_connections <= 64) {
+            opt->maintenance_connections = maintenance_connections;
+        } else {
+            throw_value_out_of_range("/maintenance_connections",
+                                     to_string(maintenance_connections),
+                                     "1 to 64");
+        }
+    }
+    int upsert_percent = 0;
+    if (conf.get_int("/upsert_max_change_percent", false, &upsert_percent)) {
+        if (0 <= upsert_percent && upsert_percent <= 100) {
+            opt->upsert_max_change_percent = upsert_percent;
+        } else {
+            throw_value_out_of_range("/upsert_max_change_percent",
+                                     to_string(upsert_percent), "0 to 100");
+        }
+    }
+    int unused_updates = 0;
+    if (conf.get_int("/index_unused_updates", false, &unused_updates)) {
+        if (unused_updates >= 1) {
+            opt->index_unused_updates = unused_updates;
+        } else {
+            throw_value_out_of_range("/index_unused_updates",
+                                     to_string(unused_updates), "1 or more");
+        }
+    }
+
     conf.get_bool("/parallel_vacuum", &(opt->parallel_vacuum));
 
     conf.get_bool("/parallel_update", &(opt->parallel_update));
@@ -34,6 +34,45 @@ ldp_log::~ldp_log()
 
 void ldp_log::write(log_level lv, const char* type, const string& table,
         const string& message, double elapsed_time)
+{
+    string values;
+    if (prepare(lv, type, table, message, elapsed_time, &values))
+        insert(values);
+}
+
+/* *
+ * \brief Writes a number of messages at the same level, recording them
+ * in the log with one statement per block of messages instead of one
+ * per message.
+ */
+void ldp_log::write_all(log_level lv, const char* type, const string& table,
+        const vector<string>& messages)
+{
+    string values;
+    size_t count = 0;
+    for (const auto& message : messages) {
+        string v;
+        if (!prepare(lv, type, table, message, -1, &v))
+            continue;
+        if (count > 0)
+            values += ",\n";
+        values += v;
+        if (++count == 1000) {
+            insert(values);
+            values.clear();
+            count = 0;
+        }
+    }
+    if (count > 0)
+        insert(values);
+}
+
+/* *
+ * \brief Prints a message if needed, and returns true with the row to
+ * be inserted in the log if the message is to be recorded.
+ */
+bool ldp_log::prepare(log_level lv, const char* type, const string& table,
+        const string& message, double elapsed_time, string* values)
 {
     // Add a prefix to highlight error states.
     string logmsg;
@@ -96,36 +135,42 @@ void ldp_log::write(log_level lv, const char* type, const string& table,
     case log_level::debug:
         if (this->lv != log_level::debug && this->lv != log_level::trace &&
                 this->lv != log_level::detail)
-            return;
+            return false;
         if (console && !quiet)
             fprintf(stderr, "ldp: %s\n", printmsg.c_str());
         level_str = "debug";
         break;
     case log_level::trace:
         if (this->lv != log_level::trace && this->lv != log_level::detail)
-            return;
+            return false;
         if (console && !quiet)
             fprintf(stderr, "ldp: %s\n", printmsg.c_str());
         level_str = "trace";
-        return;
+        return false;
     case log_level::detail:
         if (this->lv != log_level::detail)
-            return;
+            return false;
         if (console && !quiet)
             fprintf(stderr, "%s\n", printmsg.c_str());
-        return;
+        return false;
     }
 
     // Log the message, and print if the log is not available.
     string logmsg_encoded;
     dbt->encode_string_const(logmsg.c_str(), &logmsg_encoded);
+    *values =
+        "    (" + string(dbt->current_timestamp()) + ", " +
+        to_string(getpid()) + ", '" + level_str + "', '" + type + "', '" +
+        table + "', " + logmsg_encoded + ", " + elapsed_time_str + ")";
+    return true;
+}
+
+void ldp_log::insert(const string& values)
+{
     string sql =
         "INSERT INTO dbsystem.log\n"
         "    (log_time, pid, level, type, table_name, message, elapsed_time)\n"
-        "  VALUES\n"
-        "    (" + string(dbt->current_timestamp()) + ", " +
-        to_string(getpid()) + ", '" + level_str + "', '" + type + "', '" +
-        table + "', " + logmsg_encoded + ", " + elapsed_time_str + ");";
+        "  VALUES\n" + values + ";";
 
     if (conn == nullptr) {
         etymon::pgconn c(*dbinfo);
@@ -3,6 +3,7 @@
 
 #include <chrono>
 #include <string>
+#include <vector>
 
 #include "../etymoncpp/include/postgres.h"
 #include "dbtype.h"
@@ -26,12 +27,17 @@ public:
     ~ldp_log();
     void write(log_level lv, const char* type, const string& table,
             const string& message, double elapsed_time);
+    void write_all(log_level lv, const char* type, const string& table,
+            const vector<string>& messages);
     void warning(const string& message);
     void trace(const string& message);
     void detail(const string& message);
     void perf(const string& message, double elapsed_time);
 private:
     void init(log_level lv, bool console, bool quiet);
+    bool prepare(log_level lv, const char* type, const string& table,
+            const string& message, double elapsed_time, string* values);
+    void insert(const string& values);
     log_level lv;
     bool console = false;
     bool quiet = false;
@@ -0,0 +1,181 @@
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+#include "maintenance.h"
+#include "timer.h"
+#include "util.h"
+
+class maintenance_task {
+public:
+    string table;
+    bool vacuum;
+};
+
+static void maintenance_sql(const ldp_options& opt, const dbtype& dbt,
+                            const maintenance_task& task,
+                            vector<string>* sqls)
+{
+    sqls->clear();
+    if (!task.vacuum) {
+        sqls->push_back("ANALYZE " + task.table + ";");
+        return;
+    }
+    if (dbt.type() == dbsys::postgresql) {
+        sqls->push_back("VACUUM (ANALYZE" +
+                        string(opt.parallel_vacuum ? "" : ", PARALLEL 0") +
+                        ") " + task.table + ";");
+    } else {
+        string v;
+        vacuum_sql(opt, &v);
+        sqls->push_back(v + task.table + ";");
+        sqls->push_back("ANALYZE " + task.table + ";");
+    }
+}
+
+/* *
+ * \brief Reads tasks from the pipe and runs them until the pipe is
+ * closed by all of the scheduling processes.
+ */
+static void run_maintenance(const ldp_options& opt, int fd)
+{
+    ldp_log lg(opt.lg_level, opt.console, opt.quiet, &(opt.dbinfo));
+    etymon::pgconn conn(opt.dbinfo);
+    dbtype dbt(&conn);
+
+    // Redshift runs only one vacuum at a time.
+    size_t size = dbt.type() == dbsys::postgresql ?
+        opt.maintenance_connections : 1;
+    vector<unique_ptr<etymon::pgconn>> pool;
+    vector<etymon::pgconn*> conns;
+    open_connection_pool(opt, &lg, size, &conn, &pool, &conns);
+
+    deque<maintenance_task> tasks;
+    bool done = false;
+    mutex mtx;
+    condition_variable cv;
+    auto worker = [&](etymon::pgconn* c) {
+        while (true) {
+            maintenance_task task;
+            {
+                unique_lock<mutex> lock(mtx);
+                cv.wait(lock, [&] { return done || !tasks.empty(); });
+                if (tasks.empty())
+                    return;
+                task = tasks.front();
+                tasks.pop_front();
+            }
+            vector<string> sqls;
+            maintenance_sql(opt, dbt, task, &sqls);
+            for (const auto& sql : sqls) {
+                lg.detail(sql);
+                try {
+                    etymon::pgconn_result r(c, sql);
+                } catch (runtime_error& e) {
+                    lg.write(log_level::warning, "server", "",
+                             task.table + ": " + e.what(), -1);
+                    break;
+                }
+            }
+        }
+    };
+    vector<thread> threads;
+    for (auto c : conns)
+        threads.emplace_back(worker, c);
+
+    // Each line has the form "<v|a> <table>".
+    FILE* input = fdopen(fd, "r");
+    char* line = nullptr;
+    size_t length = 0;
+    ssize_t n;
+    while ((n = getline(&line, &length, input)) > 2) {
+        if (line[n - 1] == '\n')
+            line[n - 1] = '\0';
+        {
+            lock_guard<mutex> lock(mtx);
+            tasks.push_back({string(line + 2), line[0] == 'v'});
+        }
+        cv.notify_one();
+    }
+    free(line);
+    fclose(input);
+
+    {
+        lock_guard<mutex> lock(mtx);
+        done = true;
+    }
+    cv.notify_all();
+    for (auto& t : threads)
+        t.join();
+}
+
+/* *
+ * \brief Starts the maintenance process.  This should be called before
+ * starting any process that schedules tables.
+ */
+void maintenance_scheduler::start(const ldp_options& opt, ldp_log* lg)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+        throw runtime_error("error creating pipe for maintenance process");
+    // A failed maintenance process should not terminate the processes
+    // that schedule tables.
+    signal(SIGPIPE, SIG_IGN);
+    pid_t p = fork();
+    if (p == 0) {
+        close(fds[1]);
+        try {
+            run_maintenance(opt, fds[0]);
+        } catch (runtime_error& e) {
+            lg->write(log_level::error, "server", "", e.what(), -1);
+            exit(1);
+        }
+        exit(0);
+    }
+    if (p < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        throw runtime_error("error starting maintenance process");
+    }
+    close(fds[0]);
+    fd = fds[1];
+    pid = p;
+}
+
+/* *
+ * \brief Schedules a table to be analyzed, and vacuumed if it was
+ * modified rather than newly created.
+ */
+void maintenance_scheduler::schedule(const string& table, bool vacuum)
+{
+    if (fd < 0)
+        return;
+    // Lines are written with a single call, which the pipe keeps intact
+    // if several processes write at the same time.
+    string line = string(vacuum ? "v" : "a") + " " + table + "\n";
+    ssize_t n = write(fd, line.data(), line.size());
+    (void) n;
+}
+
+/* *
+ * \brief Waits for all scheduled tables to be vacuumed and analyzed.
+ */
+void maintenance_scheduler::finish(ldp_log* lg)
+{
+    if (fd < 0)
+        return;
+    lg->write(log_level::debug, "server", "", "completing maintenance", -1);
+    timer maintenance_timer;
+    close(fd);
+    fd = -1;
+    int stat;
+    waitpid(pid, &stat, 0);
+    lg->write(log_level::debug, "server", "", "completed maintenance",
+              maintenance_timer.elapsed_time());
+}
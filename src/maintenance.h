@@ -0,0 +1,32 @@
+#ifndef LDP_MAINTENANCE_H
+#define LDP_MAINTENANCE_H
+
+#include <string>
+#include <sys/types.h>
+
+#include "log.h"
+#include "options.h"
+
+using namespace std;
+
+/* *
+ * \brief Vacuums and analyzes tables in a separate process as soon as
+ * they have been updated.
+ *
+ * Tables are scheduled through a pipe, which is inherited by the
+ * processes that update tables, and the maintenance process runs the
+ * scheduled tasks concurrently over up to maintenance_connections
+ * database connections.  A table that was newly created only needs to
+ * be analyzed; otherwise it is vacuumed and analyzed in one pass.
+ */
+class maintenance_scheduler {
+public:
+    void start(const ldp_options& opt, ldp_log* lg);
+    void schedule(const string& table, bool vacuum);
+    void finish(ldp_log* lg);
+private:
+    int fd = -1;
+    pid_t pid = 0;
+};
+
+#endif
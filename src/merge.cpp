@@ -1,90 +1,463 @@
+#include <cstdint>
+#include <map>
+#include <stdexcept>
+
+#include "initutil.h"
 #include "merge.h"
 #include "names.h"
 #include "util.h"
 
-void create_latest_history_table(const ldp_options& opt, ldp_log* lg,
-                                 const table_schema& table,
-                                 etymon::pgconn* conn)
+/* *
+ * \brief Returns true if records of a table are staged with digests
+ * that are merged into its history table.
+ */
+bool record_digests(const ldp_options& opt, const table_schema& table)
+{
+    return opt.record_history &&
+        table.source_type != data_source_type::srs_marc_records &&
+        table.source_type != data_source_type::srs_records;
+}
+
+/* *
+ * \brief Converts the data column of a history table to JSON or JSONB,
+ * if it does not already match the configured type.
+ *
+ * This is run before staging, so that enabling or disabling the jsonb
+ * setting migrates existing historical data.
+ */
+void convert_history_data_type(const ldp_options& opt, ldp_log* lg,
+                               const table_schema& table,
+                               etymon::pgconn* conn, const dbtype& dbt)
 {
-    if (table.source_type == data_source_type::srs_marc_records) {
+    if (dbt.type() != dbsys::postgresql ||
+            table.source_type == data_source_type::srs_marc_records) {
         return;
     }
 
-    string history_table;
-    history_table_name(table.name, &history_table);
-
-    string latest_history_table;
-    latest_history_table_name(table.name, &latest_history_table);
-
     string sql =
-        "CREATE TEMP TABLE\n"
-        "    " + latest_history_table + "\n"
-        "    AS\n"
-        "SELECT id, data\n"
-        "    FROM " + history_table + " AS h1\n"
-        "    WHERE NOT EXISTS\n"
-        "      ( SELECT 1\n"
-        "            FROM " + history_table + " AS h2\n"
-        "            WHERE h1.id = h2.id AND\n"
-        "                  h1.updated < h2.updated\n"
-        "      );";
-    lg->write(log_level::detail, "", "", sql, -1);
-    { etymon::pgconn_result r(conn, sql); }
+        "SELECT data_type\n"
+        "    FROM information_schema.columns\n"
+        "    WHERE table_schema = 'history' AND\n"
+        "          table_name = '" + table.name + "' AND\n"
+        "          column_name = 'data';";
+    lg->detail(sql);
+    string data_type;
+    {
+        etymon::pgconn_result r(conn, sql);
+        if (PQntuples(r.result) == 0)
+            return;
+        data_type = PQgetvalue(r.result, 0, 0);
+    }
+    string target_type = opt.jsonb ? "jsonb" : "json";
+    if (data_type == target_type)
+        return;
 
-    string v;
-    vacuum_sql(opt, &v);
-    sql = v + latest_history_table + ";";
+    lg->write(log_level::trace, "", "",
+              table.name + ": converting history to " + target_type, -1);
+    // The view of versions depends on the column, and it is recreated
+    // by create_history_versions_view().
+    sql = "DROP VIEW IF EXISTS history." + table.name + "_versions;";
     lg->detail(sql);
     { etymon::pgconn_result r(conn, sql); }
-    sql = "ANALYZE " + latest_history_table + ";";
+    sql =
+        "ALTER TABLE history." + table.name + "\n"
+        "    ALTER COLUMN data TYPE " + target_type + "\n"
+        "    USING data::" + target_type + ";";
     lg->detail(sql);
     { etymon::pgconn_result r(conn, sql); }
 }
 
-void drop_latest_history_table(const ldp_options& opt, ldp_log* lg,
-                               const table_schema& table,
-                               etymon::pgconn* conn)
+/* *
+ * \brief Creates or replaces the view that reconstructs every version
+ * of the records in a history table.
+ */
+void create_history_versions_view(const ldp_options& opt, ldp_log* lg,
+                                  const table_schema& table,
+                                  etymon::pgconn* conn, const dbtype& dbt)
 {
-    if (table.source_type == data_source_type::srs_marc_records) {
+    string sql;
+    create_history_versions_view_sql(table.name, dbt, &sql);
+    if (sql.empty())
         return;
+    lg->detail(sql);
+    { etymon::pgconn_result r(conn, sql); }
+    string view = "history." + table.name + "_versions";
+    for (const string& user : {opt.ldp_user, opt.ldpconfig_user}) {
+        grant_select_on_table_sql(view, user, conn, &sql);
+        lg->detail(sql);
+        { etymon::pgconn_result r(conn, sql); }
     }
+}
 
-    string latest_history_table;
-    latest_history_table_name(table.name, &latest_history_table);
+/* *
+ * \brief Creates the partitions of a history table for the current and
+ * the next period, if they do not exist.
+ *
+ * The next period is included so that an update that runs across the
+ * end of a period does not store rows in the default partition, which
+ * would prevent the partition for that period from being created.
+ */
+void create_history_partitions(const ldp_options& opt, ldp_log* lg,
+                               const table_schema& table,
+                               etymon::pgconn* conn, const dbtype& dbt)
+{
+    if (dbt.type() != dbsys::postgresql)
+        return;
 
-    string sql = "DROP TABLE IF EXISTS " + latest_history_table + ";";
+    string sql =
+        "SELECT extract(year FROM now() AT TIME ZONE 'UTC'),\n"
+        "       extract(month FROM now() AT TIME ZONE 'UTC')\n"
+        "    FROM pg_partitioned_table AS p\n"
+        "        JOIN pg_class AS c ON p.partrelid = c.oid\n"
+        "        JOIN pg_namespace AS n ON c.relnamespace = n.oid\n"
+        "    WHERE n.nspname = 'history' AND\n"
+        "          c.relname = '" + table.name + "';";
     lg->detail(sql);
-    { etymon::pgconn_result r(conn, sql); }
+    int month_index;
+    {
+        etymon::pgconn_result r(conn, sql);
+        if (PQntuples(r.result) == 0)
+            return;
+        month_index = stoi(PQgetvalue(r.result, 0, 0)) * 12 +
+            stoi(PQgetvalue(r.result, 0, 1)) - 1;
+    }
+
+    int months = opt.history_partition_months;
+    int start = month_index - month_index % months;
+    for (int period = start; period <= start + months; period += months) {
+        string partition;
+        create_history_partition_sql(table.name, period / 12,
+                                     period % 12 + 1, months, &partition,
+                                     &sql);
+        string exists_sql = "SELECT to_regclass('" + partition + "');";
+        lg->detail(exists_sql);
+        {
+            etymon::pgconn_result r(conn, exists_sql);
+            if (!PQgetisnull(r.result, 0, 0))
+                continue;
+        }
+        lg->detail(sql);
+        try {
+            { etymon::pgconn_result r(conn, sql); }
+        } catch (runtime_error& e) {
+            // The range may overlap an existing partition if
+            // history_partition_months has been changed.
+            lg->write(log_level::warning, "server", table.name,
+                      "Unable to create history partition: " + partition +
+                      "\n    Action: Rows for this period will be stored in "
+                      "the default partition\n" + e.what(), -1);
+        }
+    }
 }
 
-void merge_table(const ldp_options& opt, ldp_log* lg, const table_schema& table, etymon::pgconn* conn, const dbtype& dbt)
+/* *
+ * \brief Records changed, new, and deleted records in the history
+ * table.
+ *
+ * The latest version of each record in history is flagged with
+ * is_current, which is maintained here so that only the changed
+ * records are updated.  Records are compared by digest, which is read
+ * from the table loaded by stage_table_2() and dropped here, and records
+ * in history that have no digest are compared by data.  A record that is
+ * no longer in the loading table is recorded as a tombstone, a current
+ * version flagged as deleted that retains the last data.
+ */
+void merge_table(const ldp_options& opt, ldp_log* lg, const table_schema& table, etymon::pgconn* conn, const dbtype& dbt, size_t* changed_count, size_t* deleted_count)
 {
-    // Update history tables.
-
     string history_table;
     history_table_name(table.name, &history_table);
 
-    string latest_history_table;
-    latest_history_table_name(table.name, &latest_history_table);
-
     string loading_table;
     loading_table_name(table.name, &loading_table);
 
+    // Every record that has data has a digest in this table.
+    string digest_table;
+    digest_table_name(table.name, &digest_table);
+
+    // JSONB values are compared directly, which ignores formatting and
+    // the order of keys.
+    string changed = opt.jsonb && dbt.type() == dbsys::postgresql ?
+        "s.data <> h.data" : "(s.data)::varchar <> (h.data)::varchar";
+
+    // Retire the current versions of changed records.  With deltas,
+    // the data of a retired version are replaced by the top-level
+    // members that differ from the new version.
+    string retire = "is_current = FALSE";
+    if (opt.history_deltas && dbt.type() == dbsys::postgresql) {
+        retire +=
+            ",\n"
+            "        data = NULL,\n"
+            "        delta = jsonb_build_object(\n"
+            "            'set',\n"
+            "            ( SELECT coalesce(jsonb_object_agg(o.key, o.value),\n"
+            "                              '{}'::jsonb)\n"
+            "                  FROM jsonb_each(h.data) AS o\n"
+            "                  WHERE (s.data->o.key) IS DISTINCT FROM o.value ),\n"
+            "            'unset',\n"
+            "            ( SELECT coalesce(jsonb_agg(k), '[]'::jsonb)\n"
+            "                  FROM jsonb_object_keys(s.data) AS k\n"
+            "                  WHERE NOT h.data ? k ) )";
+    }
     string sql =
+        "UPDATE " + history_table + " AS h\n"
+        "    SET " + retire + "\n"
+        "    FROM " + loading_table + " AS s\n"
+        "        JOIN " + digest_table + " AS d ON s.id = d.id\n"
+        "    WHERE h.id = s.id AND\n"
+        "          h.is_current AND\n"
+        "          s.data IS NOT NULL AND\n"
+        "          ( h.deleted OR\n"
+        "            d.digest <> h.digest OR\n"
+        "            ( h.digest IS NULL AND " + changed + " ) );";
+    lg->write(log_level::detail, "", "", sql, -1);
+    { etymon::pgconn_result r(conn, sql); }
+
+    // Add new versions of records that now have no current version.
+    sql =
         "INSERT INTO " + history_table + "\n"
-        "    (id, data, updated)\n"
+        "    (id, data, updated, digest, is_current)\n"
         "SELECT s.id,\n"
         "       s.data,\n" +
-        "       " + dbt.current_timestamp() + "\n"
+        "       " + dbt.current_timestamp() + ",\n"
+        "       d.digest,\n"
+        "       TRUE\n"
         "    FROM " + loading_table + " AS s\n"
-        "        LEFT JOIN " + latest_history_table + "\n"
+        "        JOIN " + digest_table + " AS d ON s.id = d.id\n"
+        "        LEFT JOIN " + history_table + "\n"
         "            AS h\n"
-        "            ON s.id = h.id\n"
+        "            ON s.id = h.id AND h.is_current\n"
         "    WHERE s.data IS NOT NULL AND\n"
-        "          ( h.id IS NULL OR\n"
-        "            (s.data)::varchar <> (h.data)::varchar );";
+        "          h.id IS NULL;";
     lg->write(log_level::detail, "", "", sql, -1);
+    {
+        etymon::pgconn_result r(conn, sql);
+        *changed_count = stoul(PQcmdTuples(r.result));
+    }
+
+    // Retire the current versions of deleted records and add tombstones
+    // that replace them, using an anti-join against the loading table,
+    // which has an index on id.  In PostgreSQL this is a single
+    // statement, so that the anti-join is run only once.
+    string deleted_filter =
+        "    WHERE h.is_current AND\n"
+        "          NOT h.deleted AND\n"
+        "          NOT EXISTS\n"
+        "            ( SELECT 1\n"
+        "                  FROM " + loading_table + " AS s\n"
+        "                  WHERE s.id = h.id )";
+    string tombstone_columns =
+        "    (id, data, updated, is_current, deleted)\n"
+        "SELECT h.id,\n"
+        "       h.data,\n"
+        "       " + string(dbt.current_timestamp()) + ",\n"
+        "       TRUE,\n"
+        "       TRUE\n";
+    if (dbt.type() == dbsys::postgresql) {
+        sql =
+            "WITH h AS (\n"
+            "    UPDATE " + history_table + " AS h\n"
+            "        SET is_current = FALSE\n" +
+            deleted_filter + "\n"
+            "        RETURNING h.id, h.data\n"
+            ")\n"
+            "INSERT INTO " + history_table + "\n" +
+            tombstone_columns +
+            "    FROM h;";
+        lg->detail(sql);
+        etymon::pgconn_result r(conn, sql);
+        *deleted_count = stoul(PQcmdTuples(r.result));
+    } else {
+        sql =
+            "INSERT INTO " + history_table + "\n" +
+            tombstone_columns +
+            "    FROM " + history_table + " AS h\n" +
+            deleted_filter + ";";
+        lg->detail(sql);
+        {
+            etymon::pgconn_result r(conn, sql);
+            *deleted_count = stoul(PQcmdTuples(r.result));
+        }
+        if (*deleted_count > 0) {
+            sql =
+                "UPDATE " + history_table + " AS h\n"
+                "    SET is_current = FALSE\n" +
+                deleted_filter + ";";
+            lg->detail(sql);
+            { etymon::pgconn_result r(conn, sql); }
+        }
+    }
+    if (*deleted_count > 0) {
+        lg->write(log_level::trace, "", "",
+                  table.name + ": deleted: " + to_string(*deleted_count), -1);
+    }
+
+    sql = "DROP TABLE " + digest_table + ";";
+    lg->detail(sql);
+    { etymon::pgconn_result r(conn, sql); }
+}
+
+class column_definition {
+public:
+    string data_type;
+    int64_t length = 0;
+};
+
+static void select_column_definitions(ldp_log* lg, const string& table,
+                                      etymon::pgconn* conn,
+                                      map<string, column_definition>* columns)
+{
+    columns->clear();
+    string sql =
+        "SELECT column_name, data_type, character_maximum_length\n"
+        "    FROM information_schema.columns\n"
+        "    WHERE table_schema = 'public' AND\n"
+        "          table_name = '" + table + "';";
+    lg->detail(sql);
+    etymon::pgconn_result r(conn, sql);
+    for (int x = 0; x < PQntuples(r.result); x++) {
+        column_definition& c = (*columns)[PQgetvalue(r.result, x, 0)];
+        c.data_type = PQgetvalue(r.result, x, 1);
+        if (!PQgetisnull(r.result, x, 2))
+            c.length = stoll(PQgetvalue(r.result, x, 2));
+    }
+}
+
+/* *
+ * \brief Decides whether a merged table should be updated in place
+ * rather than replaced by the loading table.
+ *
+ * This requires PostgreSQL, an existing table with a primary key and
+ * the same columns as the loading table, and a number of changed and
+ * deleted records within upsert_max_change_percent of the existing
+ * records.  A varchar column that is shorter than in the loading table
+ * cannot be used, since altering it would fail if a view depends on it,
+ * and a table that retains dropped columns is replaced instead.
+ */
+bool select_upsert(const ldp_options& opt, ldp_log* lg,
+                   const table_schema& table, size_t changed_count,
+                   size_t deleted_count, etymon::pgconn* conn,
+                   const dbtype& dbt)
+{
+    if (opt.upsert_max_change_percent == 0 ||
+            dbt.type() != dbsys::postgresql)
+        return false;
+
+    string loading_table;
+    loading_table_name(table.name, &loading_table);
+    map<string, column_definition> existing, loading;
+    select_column_definitions(lg, table.name, conn, &existing);
+    select_column_definitions(lg, loading_table, conn, &loading);
+    if (existing.size() == 0 || existing.size() != loading.size())
+        return false;
+    for (const auto& [name, c] : loading) {
+        auto e = existing.find(name);
+        if (e == existing.end() || e->second.data_type != c.data_type ||
+                e->second.length < c.length)
+            return false;
+    }
+
+    string sql =
+        "SELECT (SELECT count(*)\n"
+        "            FROM pg_index\n"
+        "            WHERE indrelid = 'public." + table.name + "'::regclass AND\n"
+        "                  indisprimary),\n"
+        "       (SELECT count(*)\n"
+        "            FROM pg_attribute\n"
+        "            WHERE attrelid = 'public." + table.name + "'::regclass AND\n"
+        "                  attisdropped),\n"
+        "       (SELECT count(*) FROM " + table.name + ");";
+    lg->detail(sql);
+    int64_t primary_keys, dropped_columns, row_count;
+    {
+        etymon::pgconn_result r(conn, sql);
+        primary_keys = stoll(PQgetvalue(r.result, 0, 0));
+        dropped_columns = stoll(PQgetvalue(r.result, 0, 1));
+        row_count = stoll(PQgetvalue(r.result, 0, 2));
+    }
+    // A table with dropped columns, such as the digest column of
+    // earlier versions, is replaced so that their data are removed.
+    if (primary_keys == 0 || dropped_columns > 0 || row_count == 0)
+        return false;
+    bool upsert = (int64_t) (changed_count + deleted_count) * 100 <=
+        row_count * opt.upsert_max_change_percent;
+    lg->write(log_level::trace, "", "",
+              table.name + ": changed: " + to_string(changed_count) +
+              ", deleted: " + to_string(deleted_count) + " of " +
+              to_string(row_count) +
+              (upsert ? ": updating in place" : ": replacing table"), -1);
+    return upsert;
+}
+
+/* *
+ * \brief Applies changed, new, and deleted records from the loading
+ * table to the existing table, which keeps its indexes, grants, and
+ * dependent objects.
+ *
+ * The records that changed are those added to history as current
+ * versions in this transaction by merge_table(), and the deleted
+ * records are those given tombstones.  Records that have no data
+ * because they are too large are not recorded in history and are always
+ * applied.
+ */
+void upsert_table(const ldp_options& opt, ldp_log* lg,
+                  const table_schema& table, etymon::pgconn* conn,
+                  const dbtype& dbt)
+{
+    string loading_table;
+    loading_table_name(table.name, &loading_table);
+    string history_table;
+    history_table_name(table.name, &history_table);
+
+    map<string, column_definition> columns;
+    select_column_definitions(lg, loading_table, conn, &columns);
+    string column_list, update_list;
+    for (const auto& [name, c] : columns) {
+        if (!column_list.empty())
+            column_list += ", ";
+        column_list += "\"" + name + "\"";
+        if (name == "id")
+            continue;
+        if (!update_list.empty())
+            update_list += ",\n        ";
+        update_list += "\"" + name + "\" = EXCLUDED.\"" + name + "\"";
+    }
+
+    string sql =
+        "INSERT INTO " + table.name + "\n"
+        "    (" + column_list + ")\n"
+        "SELECT " + column_list + "\n"
+        "    FROM " + loading_table + " AS s\n"
+        "    WHERE s.data IS NULL OR\n"
+        "          s.id IN ( SELECT id\n"
+        "                        FROM " + history_table + "\n"
+        "                        WHERE is_current AND\n"
+        "                              updated = " + dbt.current_timestamp() + " )\n"
+        "    ON CONFLICT (id) DO UPDATE\n"
+        "    SET " + update_list + ";";
+    lg->detail(sql);
     { etymon::pgconn_result r(conn, sql); }
+
+    sql =
+        "DELETE FROM " + table.name + " AS t\n"
+        "    USING " + history_table + " AS h\n"
+        "    WHERE h.id = t.id AND\n"
+        "          h.is_current AND\n"
+        "          h.deleted AND\n"
+        "          h.updated = " + dbt.current_timestamp() + ";";
+    lg->detail(sql);
+    { etymon::pgconn_result r(conn, sql); }
+
+    sql =
+        "DELETE FROM " + table.name + " AS t\n"
+        "    WHERE t.data IS NULL AND\n"
+        "          NOT EXISTS\n"
+        "            ( SELECT 1\n"
+        "                  FROM " + loading_table + " AS s\n"
+        "                  WHERE s.id = t.id );";
+    lg->detail(sql);
+    { etymon::pgconn_result r(conn, sql); }
+
+    drop_table(opt, lg, loading_table, conn);
 }
 
 void drop_table(const ldp_options& opt, ldp_log* lg, const string& tableName,
@@ -107,3 +480,14 @@ void place_table(const ldp_options& opt, ldp_log* lg, const table_schema& table,
     { etymon::pgconn_result r(conn, sql); }
 }
 
+/* *
+ * \brief Converts a table that was loaded as unlogged to a logged
+ * table, which writes the table and its indexes to the WAL once.
+ */
+void set_table_logged(const ldp_options& opt, ldp_log* lg,
+                      const table_schema& table, etymon::pgconn* conn)
+{
+    string sql = "ALTER TABLE " + table.name + " SET LOGGED;";
+    lg->detail(sql);
+    { etymon::pgconn_result r(conn, sql); }
+}
@@ -9,17 +9,32 @@
 
 using namespace std;
 
-void create_latest_history_table(const ldp_options& opt, ldp_log* lg,
-                                 const table_schema& table,
-                                 etymon::pgconn* conn);
-void drop_latest_history_table(const ldp_options& opt, ldp_log* lg,
-                                 const table_schema& table,
-                                 etymon::pgconn* conn);
+bool record_digests(const ldp_options& opt, const table_schema& table);
 
+void convert_history_data_type(const ldp_options& opt, ldp_log* lg,
+                               const table_schema& table,
+                               etymon::pgconn* conn, const dbtype& dbt);
+
+void create_history_versions_view(const ldp_options& opt, ldp_log* lg,
+                                  const table_schema& table,
+                                  etymon::pgconn* conn, const dbtype& dbt);
+void create_history_partitions(const ldp_options& opt, ldp_log* lg,
+                               const table_schema& table,
+                               etymon::pgconn* conn, const dbtype& dbt);
 void merge_table(const ldp_options& opt, ldp_log* lg, const table_schema& table,
-                 etymon::pgconn* conn, const dbtype& dbt);
+                 etymon::pgconn* conn, const dbtype& dbt,
+                 size_t* changed_count, size_t* deleted_count);
+bool select_upsert(const ldp_options& opt, ldp_log* lg,
+                   const table_schema& table, size_t changed_count,
+                   size_t deleted_count, etymon::pgconn* conn,
+                   const dbtype& dbt);
+void upsert_table(const ldp_options& opt, ldp_log* lg,
+                  const table_schema& table, etymon::pgconn* conn,
+                  const dbtype& dbt);
 void drop_table(const ldp_options& opt, ldp_log* lg, const string& tableName,
                 etymon::pgconn* conn);
+void set_table_logged(const ldp_options& opt, ldp_log* lg,
+                      const table_schema& table, etymon::pgconn* conn);
 void place_table(const ldp_options& opt, ldp_log* lg, const table_schema& table,
                  etymon::pgconn* conn);
 
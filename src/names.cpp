@@ -5,9 +5,9 @@ void loading_table_name(const string& table, string* newtable)
     *newtable = "ldp_" + table;
 }
 
-void latest_history_table_name(const string& table, string* newtable)
+void digest_table_name(const string& table, string* newtable)
 {
-    *newtable = "history_latest_" + table;
+    *newtable = "ldp_" + table + "_digest";
 }
 
 void history_table_name(const string& table, string* newtable)
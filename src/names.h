@@ -6,7 +6,7 @@
 using namespace std;
 
 void loading_table_name(const string& table, string* newtable);
-void latest_history_table_name(const string& table, string* newtable);
+void digest_table_name(const string& table, string* newtable);
 void history_table_name(const string& table, string* newtable);
 
 #endif
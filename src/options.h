@@ -83,6 +83,12 @@ public:
     string table;
     bool anonymize = true;
     bool record_history = true;
+    bool compact_json = false;
+    bool jsonb = false;
+    map<string, vector<string>> jsonb_indexes;
+    bool unlogged_loading_tables = false;
+    bool keep_tables_unlogged = false;
+    map<string, string> session_settings;
     bool parallel_vacuum = true;
     bool parallel_update = true;
     bool index_large_varchar = false;
@@ -97,6 +103,17 @@ public:
     bool direct_extraction_no_ssl = false;
     int okapi_timeout = 60;
     size_t page_size = 1000;
+    int analyze_sample_percent = 100;
+    int index_connections = 1;
+    int foreign_key_connections = 1;
+    int maintenance_connections = 1;
+    bool advise_indexes = false;
+    map<string, vector<string>> index_columns;
+    map<string, vector<string>> no_index_columns;
+    int index_unused_updates = 7;
+    int history_partition_months = 1;
+    bool history_deltas = false;
+    int upsert_max_change_percent = 0;
     int nargc = 0;
     char **nargv = nullptr;
     bool allow_destructive_tests = false;
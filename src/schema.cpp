@@ -1,7 +1,80 @@
+#include <cstdio>
 #include <cstring>
 
 #include "schema.h"
 
+/* *
+ * \brief Looks up the counts for a top-level field, adding the field
+ * if it has not been seen before.
+ *
+ * \param[in] position Position of the field within the record.
+ * \param[in] name Field name.
+ * \param[in] length Length of the field name.
+ * \return The counts for the field, which remain valid until another
+ * field is added.
+ */
+type_counts* type_statistics::field(size_t position, const char* name,
+                                    size_t length)
+{
+    if (position < order.size()) {
+        size_t id = order[position];
+        const string& n = names[id];
+        if (n.length() == length && memcmp(n.data(), name, length) == 0)
+            return &(counts[id]);
+    }
+    size_t id;
+    auto it = ids.find(string_view(name, length));
+    if (it != ids.end()) {
+        id = it->second;
+    } else {
+        id = names.size();
+        names.emplace_back(name, length);
+        ids[string_view(names.back())] = id;
+        counts.push_back(type_counts());
+    }
+    if (position >= order.size())
+        order.resize(position + 1);
+    order[position] = id;
+    return &(counts[id]);
+}
+
+void type_statistics::sorted_counts(map<string,type_counts>* counts) const
+{
+    counts->clear();
+    for (size_t id = 0; id < names.size(); id++)
+        (*counts)[names[id]] = this->counts[id];
+}
+
+/* *
+ * \brief Describes the inferred columns of a table.
+ *
+ * The hash depends only on the column names and types, not on varchar
+ * lengths, so that it changes only when the structure of the table
+ * changes.
+ *
+ * \param[out] columns A list of the column names and types.
+ * \param[out] hash A 64-bit FNV-1a hash of the list, in hexadecimal.
+ */
+void table_schema::describe_columns(string* columns, string* hash) const
+{
+    columns->clear();
+    for (const auto& column : this->columns) {
+        string type_str;
+        column_schema::type_to_string(column.type, &type_str);
+        if (!columns->empty())
+            *columns += ", ";
+        *columns += column.name + " " + type_str;
+    }
+    uint64_t h = 14695981039346656037ULL;
+    for (char c : *columns) {
+        h ^= (unsigned char) c;
+        h *= 1099511628211ULL;
+    }
+    char buffer[17];
+    snprintf(buffer, sizeof buffer, "%016llx", (unsigned long long) h);
+    *hash = buffer;
+}
+
 void ldp_schema::make_default_schema(ldp_schema* schema)
 {
     schema->tables.clear();
@@ -1,7 +1,11 @@
 #ifndef LDP_SCHEMA_H
 #define LDP_SCHEMA_H
 
+#include <deque>
+#include <map>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 #include "log.h"
@@ -30,12 +34,33 @@ public:
     unsigned int max_length = 0;
 };
 
+/* *
+ * \brief Type statistics for the top-level fields of a table.
+ *
+ * Field names are interned once, and the counts are stored in a
+ * vector indexed by field ID.  Since records usually have the same
+ * fields in the same order, the field at each position in the previous
+ * record is checked first, before looking up the name.
+ */
+class type_statistics {
+public:
+    type_counts* field(size_t position, const char* name, size_t length);
+    void sorted_counts(map<string,type_counts>* counts) const;
+private:
+    deque<string> names;
+    vector<type_counts> counts;
+    unordered_map<string_view,size_t> ids;
+    vector<size_t> order;
+};
+
 class column_schema {
 public:
     string name;
     column_type type;
     unsigned int length = 0;
     string source_name;
+    // Statistics from analyzing the source data
+    type_counts counts;
     static void type_to_string(column_type type, string* str);
     static bool select_type(ldp_log* lg, const string& table,
                             const string& source_path, const string& field,
@@ -58,6 +83,12 @@ public:
     vector<column_schema> columns;
     string module_name;
     string direct_source_table;
+    // Whether the columns were inferred from a sample of the data
+    bool sampled = false;
+    // Fingerprint of the staged data, or empty if not all of the data
+    // were analyzed
+    string fingerprint;
+    void describe_columns(string* columns, string* hash) const;
 };
 
 class ldp_schema {
@@ -5,22 +5,25 @@
 #include <experimental/filesystem>
 #include <map>
 #include <memory>
-#include <regex>
+#include <string_view>
+#include <unordered_set>
 
 #include "../etymoncpp/include/mallocptr.h"
 #include "../etymoncpp/include/postgres.h"
 #include "../etymoncpp/include/util.h"
 #include "camelcase.h"
+#include "copysender.h"
 #include "dbtype.h"
+#include "digest.h"
+#include "merge.h"
 #include "names.h"
 #include "rapidjson/document.h"
 #include "rapidjson/filereadstream.h"
-#include "rapidjson/pointer.h"
 #include "rapidjson/prettywriter.h"
 #include "rapidjson/reader.h"
-#include "rapidjson/stringbuffer.h"
 #include "schema.h"
 #include "stage.h"
+#include "strclass.h"
 
 namespace fs = std::experimental::filesystem;
 namespace json = rapidjson;
@@ -29,23 +32,157 @@ const int copy_buffer_size = 125000000;
 
 constexpr json::ParseFlag pflags = json::kParseTrailingCommasFlag;
 
+const size_t record_arena_size = 1048576;
+const size_t record_stack_capacity = 1024;
+
+// Record documents allocate both values and the parsing stack from
+// memory pools, so that they can be discarded without freeing.
+typedef json::GenericDocument<json::UTF8<>, json::MemoryPoolAllocator<>,
+        json::MemoryPoolAllocator<>> record_document;
+
+/* *
+ * \brief Output stream that encodes JSON text in COPY text format.
+ *
+ * This allows a RapidJSON writer to serialize a document directly into
+ * a COPY buffer without an intermediate string.
+ */
+class copy_stream {
+public:
+    typedef char Ch;
+    string* buffer = nullptr;
+    void Put(char c) {
+        if (c == '\\' || (c >= '\b' && c <= '\r'))
+            put_escaped(c);
+        else
+            buffer->push_back(c);
+    }
+    void Flush() {}
+private:
+    void put_escaped(char c);
+};
+
+void copy_stream::put_escaped(char c)
+{
+    buffer->push_back('\\');
+    switch (c) {
+        case '\b':
+            buffer->push_back('b');
+            break;
+        case '\f':
+            buffer->push_back('f');
+            break;
+        case '\n':
+            buffer->push_back('n');
+            break;
+        case '\r':
+            buffer->push_back('r');
+            break;
+        case '\t':
+            buffer->push_back('t');
+            break;
+        case '\v':
+            buffer->push_back('v');
+            break;
+        default:
+            buffer->push_back(c);
+    }
+}
+
+/* *
+ * \brief Output stream that only computes the digest of JSON text.
+ */
+class digest_stream {
+public:
+    typedef char Ch;
+    record_digest* digest = nullptr;
+    void Put(char c) { digest->put(c); }
+    void Flush() {}
+};
+
+/* *
+ * \brief Memory that is reused for processing each record.
+ *
+ * The memory pools are backed by a preallocated buffer and are reset
+ * between records, and the strings and writers retain their capacity,
+ * so that in the usual case no memory is allocated per record.
+ */
+class record_arena {
+public:
+    char* buffer;
+    etymon::malloc_ptr buffer_ptr;
+    json::MemoryPoolAllocator<> allocator;
+    json::MemoryPoolAllocator<> stack_allocator;
+    // JSON text of the current record
+    string record;
+    // JSON pointer to the current node
+    string path;
+    // Formatted column value
+    string encoded;
+    record_digest digest;
+    string digest_hex;
+    // If set, a line of COPY text with the ID and digest of each record
+    // is written to this file.
+    FILE* digests = nullptr;
+    copy_stream data_stream;
+    json::PrettyWriter<copy_stream> pretty_writer;
+    json::Writer<copy_stream> writer;
+    digest_stream canonical_stream;
+    json::Writer<digest_stream> canonical_writer;
+    record_arena() :
+        buffer((char*) malloc(record_arena_size * 2)),
+        buffer_ptr(buffer),
+        allocator(buffer, record_arena_size),
+        stack_allocator(buffer + record_arena_size, record_arena_size) {}
+    void reset();
+    void digest_record(const json::Value& doc);
+};
+
+void record_arena::reset()
+{
+    // Release any additional chunks, and rewind the preallocated buffer.
+    allocator.Clear();
+    stack_allocator.Clear();
+}
+
+/* *
+ * \brief Computes the digest of a record's compact JSON text, which
+ * does not depend on how the data column is formatted.
+ *
+ * The digest is left in the digest member to be finished by the caller.
+ */
+void record_arena::digest_record(const json::Value& doc)
+{
+    digest.reset();
+    canonical_stream.digest = &digest;
+    canonical_writer.Reset(canonical_stream);
+    doc.Accept(canonical_writer);
+}
+
+static inline bool is_id_name(const json::Value& name)
+{
+    const char* s = name.GetString();
+    return name.GetStringLength() == 2 && s[0] == 'i' && s[1] == 'd';
+}
+
 struct name_comparator {
     bool operator()(const json::Value::Member &lhs,
             const json::Value::Member &rhs) const {
-        const char* s1 = lhs.name.GetString();
-        const char* s2 = rhs.name.GetString();
-        if (strcmp(s1, "id") == 0)
+        if (is_id_name(lhs.name))
             return true;
-        if (strcmp(s2, "id") == 0)
+        if (is_id_name(rhs.name))
             return false;
-        return (strcmp(s1, s2) < 0);
+        return (strcmp(lhs.name.GetString(), rhs.name.GetString()) < 0);
     }
 };
 
-bool looks_like_date_time(const char* str)
+// Sorts the members of an object by name, with "id" first.  Records
+// usually arrive with their members already in order, in which case the
+// check is a single linear pass and no sorting is done.
+static void sort_members(json::Value* node)
 {
-    static regex date_time("^\\d{4}-\\d{2}-\\d{2}T\\d{2}:\\d{2}:\\d{2}");
-    return regex_search(str, date_time);
+    name_comparator comp;
+    if (!is_sorted(node->MemberBegin(), node->MemberEnd(), comp))
+        sort(node->MemberBegin(), node->MemberEnd(), comp);
 }
 
 bool ends_with(string const &str, string const &suffix) {
@@ -56,18 +193,21 @@ bool ends_with(string const &str, string const &suffix) {
 	return false;
 }
 
+bool filter_object_data(const table_schema& table)
+{
+    return table.name == "course_copyrightstatuses" ||
+        table.name == "course_courselistings" ||
+        table.name == "course_courses" ||
+        table.name == "course_coursetypes" ||
+        table.name == "course_departments" ||
+        table.name == "course_processingstatuses" ||
+        table.name == "course_reserves" ||
+        table.name == "course_roles" ||
+        table.name == "course_terms";
+}
+
 bool data_to_filter(const table_schema& table, const string& field)
 {
-    if (table.name != "course_copyrightstatuses" &&
-        table.name != "course_courselistings" &&
-        table.name != "course_courses" &&
-        table.name != "course_coursetypes" &&
-        table.name != "course_departments" &&
-        table.name != "course_processingstatuses" &&
-        table.name != "course_reserves" &&
-        table.name != "course_roles" &&
-        table.name != "course_terms")
-        return false;
     if (!ends_with(field, "Object") && !ends_with(field, "Objects"))
         return false;
     if (table.name == "course_courselistings" && strncmp(field.data(), "/instructorObjects", 18) == 0)
@@ -75,91 +215,164 @@ bool data_to_filter(const table_schema& table, const string& field)
     return true;
 }
 
+/* *
+ * \brief Collects the source names of a table's columns, which refer to
+ * the table and remain valid as long as its columns are not changed.
+ */
+void column_source_names(const table_schema& table,
+                         unordered_set<string_view>* columns)
+{
+    columns->clear();
+    for (const auto& column : table.columns)
+        columns->insert(string_view(column.source_name));
+}
+
+/* *
+ * \brief Data to be removed from the records of a table, prepared
+ * once per table.
+ */
+class record_filter {
+public:
+    // Tree of fields to drop
+    field_node drop_fields;
+    // Whether to remove "...Object" and "...Objects" data
+    bool filter_objects;
+    // Whether to sort object members, so that the JSON text of
+    // unchanged records compares equal
+    bool normalize;
+    // Source names of the table's columns, if they have been selected
+    unordered_set<string_view> columns;
+    record_filter(const table_schema& table, const field_set& fields,
+                  bool normalize);
+    const field_node* root() const;
+};
+
+record_filter::record_filter(const table_schema& table,
+                             const field_set& fields, bool normalize) :
+    normalize(normalize)
+{
+    fields.compile(table.name, &drop_fields);
+    filter_objects = filter_object_data(table);
+    column_source_names(table, &columns);
+}
+
+const field_node* record_filter::root() const
+{
+    // No matching is done for tables that have no fields to drop.
+    return drop_fields.empty() ? nullptr : &drop_fields;
+}
+
 // Collect statistics and anonymize data
+//
+// The node is matched against the tree of fields to drop as the record
+// is traversed, and match is the corresponding tree node or nullptr if
+// no drop fields are at or below this node.  Statistics are collected
+// if stats is given for the root node, and counts is then given for
+// each top-level field that has a scalar or null value, since only
+// those fields become columns.
 void process_json_record(const table_schema& table,
-                         json::Document* root,
+                         const record_filter& filter,
                          json::Value* node,
-                         bool collect_stats,
-                         field_set* drop_fields,
-                         const string& field,
-                         unsigned int depth,
-                         map<string,type_counts>* stats)
+                         const field_node* match,
+                         type_statistics* stats,
+                         type_counts* counts,
+                         string* path)
 {
+    const string& field = *path;
+    size_t field_length = path->length();
+    bool drop = (match != nullptr && match->match);
     switch (node->GetType()) {
         case json::kNullType:
-            if (collect_stats && depth == 1)
-                (*stats)[field.c_str() + 1].null++;
+            if (counts != nullptr)
+                counts->null++;
             break;
         case json::kTrueType:
         case json::kFalseType:
-            if (drop_fields->find(table.name, field))
-                json::Pointer(field.c_str()).Set(*root, false);
-            if (collect_stats && depth == 1)
-                (*stats)[field.c_str() + 1].boolean++;
+            if (drop)
+                node->SetBool(false);
+            if (counts != nullptr)
+                counts->boolean++;
             break;
         case json::kNumberType:
-            if (drop_fields->find(table.name, field))
-                json::Pointer(field.c_str()).Set(*root, 0);
-            if (collect_stats && depth == 1) {
-                (*stats)[field.c_str() + 1].number++;
+            if (drop)
+                node->SetInt(0);
+            if (counts != nullptr) {
+                counts->number++;
                 if (node->IsInt() || node->IsUint() || node->IsInt64() ||
                         node->IsUint64())
-                    (*stats)[field.c_str() + 1].integer++;
+                    counts->integer++;
                 else
-                    (*stats)[field.c_str() + 1].floating++;
+                    counts->floating++;
             }
             break;
         case json::kStringType:
-            if (drop_fields->find(table.name, field))
-                json::Pointer(field.c_str()).Set(*root, "");
-            if (collect_stats && depth == 1) {
-                (*stats)[field.c_str() + 1].string++;
-                if (is_uuid(node->GetString()))
-                    (*stats)[field.c_str() + 1].uuid++;
-                if (looks_like_date_time(node->GetString()))
-                    (*stats)[field.c_str() + 1].date_time++;
-                size_t slen = strlen(node->GetString());
-                if (slen > (*stats)[field.c_str() + 1].max_length)
-                    (*stats)[field.c_str() + 1].max_length = slen;
+            if (drop)
+                node->SetString("", 0);
+            if (counts != nullptr) {
+                counts->string++;
+                string_class cls;
+                classify_string(node->GetString(), node->GetStringLength(),
+                                &cls);
+                if (cls.uuid)
+                    counts->uuid++;
+                if (cls.date_time)
+                    counts->date_time++;
+                if (cls.length > counts->max_length)
+                    counts->max_length = cls.length;
             }
             break;
         case json::kArrayType:
-            if (drop_fields->find(table.name, field)) {
-		json::Pointer(field.c_str()).Set(*root, json::kNullType);
-		break;
+            if (drop) {
+                node->SetNull();
+                break;
             }
-            if (data_to_filter(table, field)) {
-		json::Pointer(field.c_str()).Set(*root, json::kNullType);
-		break;
+            if (filter.filter_objects && data_to_filter(table, field)) {
+                node->SetNull();
+                break;
             }
             {
                 int x = 0;
                 for (json::Value::ValueIterator i = node->Begin();
                         i != node->End(); ++i) {
-                    string new_field = field;
-                    new_field += '/';
-                    new_field += to_string(x);
-                    process_json_record(table, root, i, collect_stats, drop_fields, new_field, depth + 1, stats);
+                    *path += '/';
+                    *path += to_string(x);
+                    const field_node* m = nullptr;
+                    if (match != nullptr)
+                        m = match->find_child(path->data() + field_length + 1,
+                                              path->length() - field_length - 1);
+                    process_json_record(table, filter, i, m, nullptr, nullptr, path);
+                    path->resize(field_length);
                     x++;
                 }
             }
             break;
         case json::kObjectType:
-            if (drop_fields->find(table.name, field)) {
-		json::Pointer(field.c_str()).Set(*root, json::kNullType);
-		break;
+            if (drop) {
+                node->SetNull();
+                break;
             }
-            if (data_to_filter(table, field)) {
-		json::Pointer(field.c_str()).Set(*root, json::kNullType);
-		break;
+            if (filter.filter_objects && data_to_filter(table, field)) {
+                node->SetNull();
+                break;
             }
-            sort(node->MemberBegin(), node->MemberEnd(), name_comparator());
+            if (filter.normalize)
+                sort_members(node);
             for (json::Value::MemberIterator i = node->MemberBegin();
                     i != node->MemberEnd(); ++i) {
-                string new_field = field;
-                new_field += '/';
-                new_field += i->name.GetString();
-                process_json_record(table, root, &(i->value), collect_stats, drop_fields, new_field, depth + 1, stats);
+                type_counts* c = nullptr;
+                if (stats != nullptr && !i->value.IsObject() &&
+                        !i->value.IsArray())
+                    c = stats->field(i - node->MemberBegin(),
+                                     i->name.GetString(),
+                                     i->name.GetStringLength());
+                *path += '/';
+                path->append(i->name.GetString(), i->name.GetStringLength());
+                const field_node* m = nullptr;
+                if (match != nullptr)
+                    m = match->find_child(i->name.GetString(),
+                                          i->name.GetStringLength());
+                process_json_record(table, filter, &(i->value), m, nullptr, c, path);
+                path->resize(field_length);
             }
             break;
         default:
@@ -189,14 +402,16 @@ public:
     ldp_log* lg;
     int level = 0;
     bool active = false;
-    string record;
+    record_arena* arena;
+    string& record;
     const table_schema& table;
     // Collection of statistics
-    map<string,type_counts>* stats;
+    type_statistics* stats;
+    table_fingerprint* fingerprint;
     // Loading to database
-    etymon::pgconn* conn;
+    copy_sender* sender;
     const dbtype& dbt;
-    field_set* drop_fields = nullptr;
+    const record_filter& filter;
     size_t record_count = 0;
     size_t total_record_count = 0;
     string* copy_buffer;
@@ -204,19 +419,24 @@ public:
                 const ldp_options& options,
                 ldp_log* lg,
                 const table_schema& table,
-                etymon::pgconn* conn,
+                copy_sender* sender,
                 const dbtype& dbt,
-                field_set* drop_fields,
-                map<string,type_counts>* statistics,
-                string* copy_buffer) :
+                const record_filter& filter,
+                type_statistics* statistics,
+                table_fingerprint* fingerprint,
+                string* copy_buffer,
+                record_arena* arena) :
         pass(pass),
         opt(options),
         lg(lg),
+        arena(arena),
+        record(arena->record),
         table(table),
         stats(statistics),
-        conn(conn),
+        fingerprint(fingerprint),
+        sender(sender),
         dbt(dbt),
-        drop_fields(drop_fields),
+        filter(filter),
         copy_buffer(copy_buffer) {}
     bool StartObject();
     bool EndObject(json::SizeType memberCount);
@@ -252,40 +472,127 @@ static void begin_copy_batch()
 
 static void end_copy_batch(const ldp_options& opt, ldp_log* lg,
                         const string& table, string* buffer,
-                        etymon::pgconn* conn)
+                        copy_sender* sender)
 {
-    int r = PQputCopyData(conn->conn, buffer->data(), buffer->length());
-    if (r == -1) {
-        throw runtime_error(PQerrorMessage(conn->conn));
+    // Hand off the buffer to the sender thread, and continue parsing
+    // into the buffer it has finished sending.
+    sender->send(buffer);
+}
+
+// Checks whether a value fits the column type inferred from a sample.
+// A value that the full analysis would have found incompatible is not
+// accepted, so that the table is analyzed again.
+static bool fits_sampled_column(const column_schema& column,
+                                const json::Value& value)
+{
+    string_class cls;
+    switch (column.type) {
+    case column_type::bigint:
+        return value.IsInt();
+    case column_type::boolean:
+        return value.IsBool();
+    case column_type::numeric:
+        return value.IsNumber();
+    case column_type::id:
+        if (!value.IsString())
+            return false;
+        classify_string(value.GetString(), value.GetStringLength(), &cls);
+        return cls.uuid;
+    case column_type::timestamptz:
+        if (!value.IsString())
+            return false;
+        classify_string(value.GetString(), value.GetStringLength(), &cls);
+        return cls.date_time;
+    case column_type::varchar:
+        return value.IsString() && value.GetStringLength() <= column.length;
+    }
+    return false;
+}
+
+/* *
+ * \brief Returns true if a page is analyzed when sampling.
+ *
+ * The first and last pages are always analyzed, together with an
+ * evenly spaced selection of the others.
+ */
+bool sample_page(size_t page, size_t page_count, int sample_percent)
+{
+    return sample_percent >= 100 || page == 0 || page == page_count - 1 ||
+        (page * sample_percent) % 100 < (size_t) sample_percent;
+}
+
+/* *
+ * \brief Returns true if a top-level field has no column because it was
+ * not present in the sample, and it is not dropped from the data.
+ *
+ * A full analysis would have added a column for the field if it has a
+ * scalar value, and so the table should be analyzed again.
+ *
+ * \param[in] columns Source names of the columns, from
+ * column_source_names().
+ */
+bool is_unsampled_field(const unordered_set<string_view>& columns,
+                        const field_node* drop_fields,
+                        const char* name, size_t length)
+{
+    if (columns.count(string_view(name, length)) > 0)
+        return false;
+    if (drop_fields != nullptr) {
+        const field_node* m = drop_fields->find_child(name, length);
+        if (m != nullptr && m->match)
+            return false;
     }
-    buffer->clear();
+    return true;
 }
 
 static void writeTuple(const ldp_options& opt, ldp_log* lg, const dbtype& dbt,
-        const table_schema& table, const json::Document& doc,
-        size_t* record_count, size_t* total_record_count, string* copy_buffer)
+        const table_schema& table, const record_filter& filter,
+        const json::Value& doc,
+        size_t* record_count, size_t* total_record_count, string* copy_buffer,
+        record_arena* arena)
 {
     //if (*record_count > 0)
     //    *insert_buffer += ',';
     //*insert_buffer += '(';
 
-    const char* id = nullptr;
+    const json::Value* id_value = nullptr;
     if (doc.HasMember("id") && doc["id"].IsString()) {
-        id = doc["id"].GetString();
+        id_value = &(doc["id"]);
     }
-    if (id == nullptr && doc.HasMember("notificationId") && doc["notificationId"].IsString()) {
-        id = doc["notificationId"].GetString();
+    if (id_value == nullptr && doc.HasMember("notificationId") && doc["notificationId"].IsString()) {
+        id_value = &(doc["notificationId"]);
     }
-    if (id == nullptr)
+    if (id_value == nullptr)
         throw runtime_error("required string field \"id\" not found in record");
+    const char* id = id_value->GetString();
 
     // id
-    string idenc;
-    dbt.encode_copy(id, &idenc);
-    *copy_buffer += idenc;
+    size_t id_start = copy_buffer->length();
+    dbt.encode_copy_append(id, id_value->GetStringLength(), copy_buffer);
+    size_t id_length = copy_buffer->length() - id_start;
     *copy_buffer += '\t';
 
-    string s;
+    // Only scalar values become columns, and the MARC records have only
+    // an id column.
+    if (table.sampled &&
+            table.source_type != data_source_type::srs_marc_records) {
+        for (auto i = doc.MemberBegin(); i != doc.MemberEnd(); ++i) {
+            if (!i->value.IsNull() && !i->value.IsObject() &&
+                    !i->value.IsArray() &&
+                    is_unsampled_field(filter.columns, filter.root(),
+                                       i->name.GetString(),
+                                       i->name.GetStringLength()))
+                throw sample_mismatch(
+                        "Field was not found in sampled data:\n"
+                        "    Table: " + table.name + "\n"
+                        "    Field: " + i->name.GetString() + "\n"
+                        "    ID: " + id);
+        }
+    }
+
+    string& s = arena->encoded;
+    size_t start;
+
     double d;
     for (const auto& column : table.columns) {
         if (column.name == "id")
@@ -300,6 +607,12 @@ static void writeTuple(const ldp_options& opt, ldp_log* lg, const dbtype& dbt,
             *copy_buffer += "\\N\t";
             continue;
         }
+        if (table.sampled && !fits_sampled_column(column, jsonValue))
+            throw sample_mismatch(
+                    "Value does not match sampled column type:\n"
+                    "    Table: " + table.name + "\n"
+                    "    Column: " + column.name + "\n"
+                    "    ID: " + id);
         switch (column.type) {
         case column_type::bigint:
             *copy_buffer += to_string(jsonValue.GetInt());
@@ -325,50 +638,73 @@ static void writeTuple(const ldp_options& opt, ldp_log* lg, const dbtype& dbt,
         case column_type::id:
         case column_type::timestamptz:
         case column_type::varchar:
-            dbt.encode_copy(jsonValue.GetString(), &s);
+            start = copy_buffer->length();
+            dbt.encode_copy_append(jsonValue.GetString(),
+                                   jsonValue.GetStringLength(), copy_buffer);
             // Check if varchar exceeds maximum string length.
-            if (s.length() >= varchar_size - 1) {
+            if (copy_buffer->length() - start >= varchar_size - 1) {
                 lg->write(log_level::warning, "", "",
                         "String length exceeds database limit:\n"
                         "    Table: " + table.name + "\n"
                         "    Column: " + column.name + "\n"
                         "    ID: " + id + "\n"
                         "    Action: Value set to NULL", -1);
-                s = "\\N";
+                copy_buffer->resize(start);
+                *copy_buffer += "\\N";
             }
-            *copy_buffer += s;
             break;
         }
         *copy_buffer += '\t';
     }
 
-    string data;
-    json::StringBuffer json_text;
-    json::PrettyWriter<json::StringBuffer> writer(json_text);
-    doc.Accept(writer);
-    dbt.encode_copy(json_text.GetString(), &data);
-    // Check if pretty-printed JSON exceeds maximum string length.
-    if (data.length() > varchar_size - 1) {
-        // Formatted JSON object size exceeds database limit.  Try
-        // compact-printed JSON.
-        json::StringBuffer json_text;
-        json::Writer<json::StringBuffer> writer(json_text);
-        doc.Accept(writer);
-        dbt.encode_copy(json_text.GetString(), &data);
-        if (data.length() > varchar_size - 1) {
+    // Serialize and encode the data column directly into the COPY buffer.
+    copy_stream& data_stream = arena->data_stream;
+    data_stream.buffer = copy_buffer;
+    start = copy_buffer->length();
+    bool compact = opt.compact_json;
+    bool data_null = false;
+    if (!compact) {
+        arena->pretty_writer.Reset(data_stream);
+        doc.Accept(arena->pretty_writer);
+        // Check if pretty-printed JSON exceeds maximum string length.
+        if (copy_buffer->length() - start > varchar_size - 1) {
+            // Formatted JSON object size exceeds database limit.  Try
+            // compact-printed JSON.
+            copy_buffer->resize(start);
+            compact = true;
+        }
+    }
+    if (compact) {
+        arena->writer.Reset(data_stream);
+        doc.Accept(arena->writer);
+        if (copy_buffer->length() - start > varchar_size - 1) {
             lg->write(log_level::warning, "", "",
                     "JSON object size exceeds database limit:\n"
                     "    Table: " + table.name + "\n"
                     "    ID: " + id + "\n"
                     "    Action: Value for column \"data\" set to NULL", -1);
-            data = "\\N";
+            copy_buffer->resize(start);
+            *copy_buffer += "\\N";
+            data_null = true;
         }
     }
 
-    //print(Print::warning, opt, "storing record as:\n" + data + "\n");
-
-    *copy_buffer += data;
     *copy_buffer += "\n";
+
+    // digest
+    if (arena->digests != nullptr && !data_null) {
+        arena->digest_record(doc);
+        arena->digest.finish(&arena->digest_hex);
+        string& line = arena->encoded;
+        line.assign(*copy_buffer, id_start, id_length);
+        line += '\t';
+        line += arena->digest_hex;
+        line += '\n';
+        if (fwrite(line.data(), 1, line.length(), arena->digests) !=
+                line.length())
+            throw runtime_error("unable to write record digests");
+    }
+
     (*record_count)++;
     (*total_record_count)++;
     //if (*total_record_count % 100000 == 0)
@@ -382,13 +718,15 @@ bool JSONHandler::EndObject(json::SizeType memberCount)
         record += '}';
 
         if (pass == 2) {
-            string brief = record;
-            if (brief.length() > 80) {
-                brief = brief.substr(0, 80) + "...";
-            }
             switch (opt.lg_level) {
             case log_level::trace:
-                lg->trace(table.name + ": " + brief);
+                {
+                    string brief = record;
+                    if (brief.length() > 80) {
+                        brief = brief.substr(0, 80) + "...";
+                    }
+                    lg->trace(table.name + ": " + brief);
+                }
                 break;
             case log_level::detail:
                 lg->detail(table.name + ": " + record);
@@ -398,26 +736,36 @@ bool JSONHandler::EndObject(json::SizeType memberCount)
             }
         }
 
-        char* buffer = strdup(record.c_str());
-        etymon::malloc_ptr bufferptr(buffer);
+        // Parse the record in place, allocating from the arena.  The
+        // record text is not used again after parsing.
+        arena->reset();
+        record_document doc(&arena->allocator,
+                            record_stack_capacity,
+                            &arena->stack_allocator);
+        doc.ParseInsitu<pflags>(&record[0]);
 
-        json::Document doc;
-        doc.ParseInsitu<pflags>(buffer);
-
-        bool collect_stats = (pass == 1);
-        string path;
+        string* path = &arena->path;
+        path->clear();
         // Collect statistics and anonymize data.
-        process_json_record(table, &doc, &doc, collect_stats, drop_fields, path, 0, stats);
+        process_json_record(table, filter, &doc, filter.root(),
+                            (pass == 1 ? stats : nullptr), nullptr, path);
+
+        if (fingerprint != nullptr) {
+            arena->digest_record(doc);
+            uint8_t d[16];
+            arena->digest.finish(d);
+            fingerprint->add(d);
+        }
 
         if (pass == 2) {
 
             if (copy_buffer->length() > (copy_buffer_size - 2000000)) {
-                end_copy_batch(opt, lg, table.name, copy_buffer, conn);
+                end_copy_batch(opt, lg, table.name, copy_buffer, sender);
                 begin_copy_batch();
                 record_count = 0;
             }
 
-            writeTuple(opt, lg, dbt, table, doc, &record_count, &total_record_count, copy_buffer);
+            writeTuple(opt, lg, dbt, table, filter, doc, &record_count, &total_record_count, copy_buffer, arena);
         }
 
     } else {
@@ -448,7 +796,7 @@ bool JSONHandler::EndArray(json::SizeType elementCount)
         active = false;
         if (record_count > 0)
             if (pass == 2)
-                end_copy_batch(opt, lg, table.name, copy_buffer, conn);
+                end_copy_batch(opt, lg, table.name, copy_buffer, sender);
     } else {
         if (level > 2)
             record += "],";
@@ -500,9 +848,7 @@ static void encode_json(const char* str, string* newstr)
 bool JSONHandler::Key(const char* str, json::SizeType length, bool copy)
 {
     record += '\"';
-    string enc_str;
-    encode_json(str, &enc_str);
-    record += enc_str;
+    encode_json(str, &record);
     record += "\":";
     return true;
 }
@@ -511,9 +857,7 @@ bool JSONHandler::String(const char* str, json::SizeType length, bool copy)
 {
     if (active && (level > 2) ) {
         record += '\"';
-        string enc_str;
-        encode_json(str, &enc_str);
-        record += enc_str;
+        encode_json(str, &record);
         record += "\",";
     }
     return true;
@@ -601,44 +945,104 @@ size_t read_page_count(const data_source& source, ldp_log* lg,
 
 static void stage_page(const ldp_options& opt, ldp_log* lg, int pass,
                        const table_schema& table,
-                       etymon::pgconn* conn, const dbtype &dbt,
-                       map<string,type_counts>* stats, const string& filename,
+                       copy_sender* sender, const dbtype &dbt,
+                       type_statistics* stats,
+                       table_fingerprint* fingerprint,
+                       const string& filename,
                        char* read_buffer, size_t read_buffer_size,
-                       field_set* drop_fields)
+                       const record_filter& filter, string* copy_buffer,
+                       record_arena* arena)
 {
     json::Reader reader;
     etymon::file f(filename, "r");
     json::FileReadStream is(f.fp, read_buffer, read_buffer_size);
 
-    if (pass == 2) {
-        string loading_table;
-        loading_table_name(table.name, &loading_table);
-        string sql = "COPY " + loading_table + " FROM STDIN;";
-        { etymon::pgconn_result r(conn, sql); }
-    }
+    JSONHandler handler(pass, opt, lg, table, sender, dbt, filter, stats,
+                        fingerprint, copy_buffer, arena);
+    reader.Parse(is, handler);
+}
 
-    {
-        string copy_buffer;
-        copy_buffer.reserve(copy_buffer_size);
-        JSONHandler handler(pass, opt, lg, table, conn, dbt, drop_fields, stats, &copy_buffer);
-        reader.Parse(is, handler);
-    }
+static void begin_copy(const table_schema& table, etymon::pgconn* conn)
+{
+    string loading_table;
+    loading_table_name(table.name, &loading_table);
+    string sql = "COPY " + loading_table + " FROM STDIN;";
+    { etymon::pgconn_result r(conn, sql); }
+}
 
-    if (pass == 2) {
-        int r = PQputCopyEnd(conn->conn, nullptr);
-        if (r == -1) {
-            throw runtime_error(PQerrorMessage(conn->conn));
+static void end_copy(etymon::pgconn* conn)
+{
+    int r = PQputCopyEnd(conn->conn, nullptr);
+    if (r == -1) {
+        throw runtime_error(PQerrorMessage(conn->conn));
+    }
+    PGresult* res = PQgetResult(conn->conn);
+    if (res == nullptr || PQresultStatus(res) == PGRES_FATAL_ERROR) {
+        string err = PQresultErrorMessage(res);
+        if (res != nullptr) {
+            PQclear(res);
         }
-        PGresult* res = PQgetResult(conn->conn);
-        if (res == nullptr || PQresultStatus(res) == PGRES_FATAL_ERROR) {
-            string err = PQresultErrorMessage(res);
-            if (res != nullptr) {
-                PQclear(res);
-            }
+        throw runtime_error(err);
+    }
+    PQclear(res);
+}
+
+// Ends a COPY with an error, so that the connection can be used again
+// after rolling back.
+static void abort_copy(etymon::pgconn* conn, const char* reason)
+{
+    PQputCopyEnd(conn->conn, reason);
+    PGresult* res;
+    while ((res = PQgetResult(conn->conn)) != nullptr)
+        PQclear(res);
+}
+
+/* *
+ * \brief Loads the record digests written during staging into a table
+ * of (id, digest), which is joined by merge_table() and then dropped.
+ *
+ * The digests are kept out of the loading table so that they are not
+ * retained in the main table's storage.
+ */
+static void load_digests(const ldp_options& opt, ldp_log* lg,
+                         const table_schema& table, FILE* digests,
+                         etymon::pgconn* conn, const dbtype& dbt)
+{
+    string digest_table;
+    digest_table_name(table.name, &digest_table);
+
+    string sql = "DROP TABLE IF EXISTS " + digest_table + ";";
+    lg->detail(sql);
+    { etymon::pgconn_result r(conn, sql); }
+
+    string rskeys;
+    dbt.redshift_keys("id", "id", &rskeys);
+    sql = (opt.unlogged_loading_tables && dbt.type() == dbsys::postgresql) ?
+        "CREATE UNLOGGED TABLE " : "CREATE TABLE ";
+    sql += digest_table + " (\n"
+        "    id VARCHAR(36) NOT NULL,\n"
+        "    digest VARCHAR(32) NOT NULL\n"
+        ")" + rskeys + ";";
+    lg->detail(sql);
+    { etymon::pgconn_result r(conn, sql); }
+
+    sql = "COPY " + digest_table + " FROM STDIN;";
+    { etymon::pgconn_result r(conn, sql); }
+    rewind(digests);
+    vector<char> buffer(1048576);
+    size_t n;
+    while ((n = fread(buffer.data(), 1, buffer.size(), digests)) > 0) {
+        if (PQputCopyData(conn->conn, buffer.data(), n) == -1) {
+            string err = PQerrorMessage(conn->conn);
+            abort_copy(conn, "unable to send record digests");
             throw runtime_error(err);
         }
-        PQclear(res);
     }
+    if (ferror(digests)) {
+        abort_copy(conn, "unable to read record digests");
+        throw runtime_error("unable to read record digests");
+    }
+    end_copy(conn);
 }
 
 static void compose_data_file_path(const string& load_dir,
@@ -653,63 +1057,6 @@ static void compose_data_file_path(const string& load_dir,
     *path += suffix;
 }
 
-void index_loaded_table(ldp_log* lg, const table_schema& table, etymon::pgconn* conn, dbtype* dbt, bool index_large_varchar)
-{
-    lg->detail("creating indexes: " + table.name);
-    // If there is no table schema, define a primary key on (id) and return.
-    if (table.columns.size() == 0) {
-        string sql =
-            "ALTER TABLE " + table.name + "\n"
-            "    ADD PRIMARY KEY (id);";
-        lg->detail(sql);
-        try {
-            { etymon::pgconn_result r(conn, sql); }
-        } catch (runtime_error& e) {
-            lg->write(log_level::warning, "server", "", e.what(), -1);
-        }
-        return;
-    }
-    // If there is a table schema, define the primary key or indexes.
-    for (const auto& column : table.columns) {
-        if (column.name == "id") {
-            string sql =
-                "ALTER TABLE " + table.name + "\n"
-                "    ADD PRIMARY KEY (id);";
-            lg->detail(sql);
-            try {
-                { etymon::pgconn_result r(conn, sql); }
-            } catch (runtime_error& e) {
-                lg->write(log_level::warning, "server", "", e.what(), -1);
-            }
-        } else {
-            // in postgres, index columns except column "data"
-            if (dbt->type() == dbsys::postgresql && column.name != "data") {
-                // create btree index unless column is a large varchar
-                if (column.type == column_type::varchar && column.length > 500) {
-                    // create hash index if index_large_varchar is enabled
-                    if (index_large_varchar) {
-                        string sql = "CREATE INDEX ON " + table.name + " USING HASH (\"" + column.name + "\");";
-                        lg->detail(sql);
-                        try {
-                            { etymon::pgconn_result r(conn, sql); }
-                        } catch (runtime_error& e) {
-                            lg->write(log_level::warning, "server", "", "Unable to create hash index: table=" + table.name + " column=" + column.name, -1);
-                        }
-                    }
-                } else {
-                    string sql = "CREATE INDEX ON " + table.name + " (\"" + column.name + "\");";
-                    lg->detail(sql);
-                    try {
-                        { etymon::pgconn_result r(conn, sql); }
-                    } catch (runtime_error& e) {
-                        lg->write(log_level::warning, "server", "", "Unable to create B-tree index: table=" + table.name + " column=" + column.name, -1);
-                    }
-                }
-            }
-        }
-    }
-}
-
 static void create_loading_table(const ldp_options& opt, ldp_log* lg,
                                  const table_schema& table,
                                  etymon::pgconn* conn, const dbtype& dbt)
@@ -723,7 +1070,9 @@ static void create_loading_table(const ldp_options& opt, ldp_log* lg,
 
     string rskeys;
     dbt.redshift_keys("id", "id", &rskeys);
-    sql = "CREATE TABLE ";
+    // An unlogged table is not written to the WAL while it is loaded.
+    sql = (opt.unlogged_loading_tables && dbt.type() == dbsys::postgresql) ?
+        "CREATE UNLOGGED TABLE " : "CREATE TABLE ";
     sql += loading_table;
     sql += " (\n"
         "    id VARCHAR(36) NOT NULL,\n";
@@ -741,8 +1090,9 @@ static void create_loading_table(const ldp_options& opt, ldp_log* lg,
             sql += ",\n";
         }
     }
-    sql += string("    data ") + dbt.json_type() + "\n"
-        ")" + rskeys + ";";
+    sql += string("    data ") +
+        (opt.jsonb ? dbt.jsonb_type() : dbt.json_type());
+    sql += "\n)" + rskeys + ";";
     lg->write(log_level::detail, "", "", sql, -1);
     { etymon::pgconn_result r(conn, sql); }
 
@@ -775,47 +1125,161 @@ static void create_loading_table(const ldp_options& opt, ldp_log* lg,
     { etymon::pgconn_result r(conn, sql); }
 }
 
-bool stage_table_1(const ldp_options& opt,
-                   const vector<source_state>& source_states,
-                   ldp_log* lg,
-                   table_schema* table,
-                   etymon::pgconn* conn,
-                   dbtype* dbt,
-                   const string& load_dir,
-                   field_set* drop_fields,
-                   char* read_buffer)
+/* *
+ * \brief Records the inferred schema and type statistics of a table in
+ * the dbsystem catalog, and logs a message if the schema has changed
+ * since the previous update.
+ */
+static void save_table_schema(ldp_log* lg, const table_schema& table,
+                              const map<string,type_counts>& stats,
+                              etymon::pgconn* conn, const dbtype& dbt)
 {
-    map<string,type_counts> stats;
+    string columns, hash;
+    table.describe_columns(&columns, &hash);
+
+    string sql =
+        "SELECT schema_hash\n"
+        "    FROM dbsystem.table_schemas\n"
+        "    WHERE table_name = '" + table.name + "'\n"
+        "    ORDER BY last_seen DESC\n"
+        "    LIMIT 1;";
+    lg->detail(sql);
+    string previous_hash;
+    {
+        etymon::pgconn_result r(conn, sql);
+        if (PQntuples(r.result) > 0)
+            previous_hash = PQgetvalue(r.result, 0, 0);
+    }
+    if (!previous_hash.empty() && previous_hash != hash)
+        lg->write(log_level::info, "server", table.name,
+                  "Table schema changed: " + columns, -1);
 
-    for (auto& state : source_states) {
-        size_t page_count = read_page_count(state.source, lg, load_dir,
-                                            table->name);
+    string now = dbt.current_timestamp();
+    string columns_const;
+    dbt.encode_string_const(columns.c_str(), &columns_const);
+    sql =
+        "UPDATE dbsystem.table_schemas\n"
+        "    SET last_seen = " + now + ",\n"
+        "        columns = " + columns_const + "\n"
+        "    WHERE table_name = '" + table.name + "' AND\n"
+        "          schema_hash = '" + hash + "';";
+    lg->detail(sql);
+    bool found;
+    {
+        etymon::pgconn_result r(conn, sql);
+        found = (strcmp(PQcmdTuples(r.result), "0") != 0);
+    }
+    if (!found) {
+        sql =
+            "INSERT INTO dbsystem.table_schemas\n"
+            "    (table_name, schema_hash, columns, first_seen, last_seen)\n"
+            "    VALUES ('" + table.name + "', '" + hash + "', " +
+            columns_const + ", " + now + ", " + now + ");";
+        lg->detail(sql);
+        { etymon::pgconn_result r(conn, sql); }
+    }
 
-        lg->write(log_level::detail, "", "",
-                  "staging: " + table->name + ": page count: " +
-                  to_string(page_count), -1);
+    sql =
+        "DELETE FROM dbsystem.field_statistics\n"
+        "    WHERE table_name = '" + table.name + "';";
+    lg->detail(sql);
+    { etymon::pgconn_result r(conn, sql); }
+    if (stats.empty())
+        return;
 
-        for (size_t page = 0; page < page_count; page++) {
-            string path;
-            compose_data_file_path(load_dir, *table, state.source.source_name,
-                                   "_" + to_string(page) + ".json", &path);
-            lg->write(log_level::detail, "", "", "staging: " + table->name + ": analyze: page: " + to_string(page), -1);
-            stage_page(opt, lg, 1, *table, conn, *dbt, &stats, path,
-                       read_buffer, sizeof read_buffer, drop_fields);
+    map<string,const column_schema*> field_columns;
+    for (const auto& column : table.columns)
+        field_columns[column.source_name] = &column;
+    sql =
+        "INSERT INTO dbsystem.field_statistics\n"
+        "    (table_name, field_name, column_name, column_type, schema_hash,\n"
+        "     string_count, date_time_count, number_count, integer_count,\n"
+        "     floating_count, boolean_count, null_count, uuid_count,\n"
+        "     max_length, updated)\n"
+        "    VALUES\n";
+    bool first = true;
+    for (const auto& [field, counts] : stats) {
+        string field_const, column_const, type_str;
+        dbt.encode_string_const(field.c_str(), &field_const);
+        auto c = field_columns.find(field);
+        if (c != field_columns.end()) {
+            dbt.encode_string_const(c->second->name.c_str(), &column_const);
+            column_schema::type_to_string(c->second->type, &type_str);
+        } else {
+            column_const = "''";
         }
+        if (!first)
+            sql += ",\n";
+        first = false;
+        sql +=
+            "    ('" + table.name + "', " + field_const + ", " +
+            column_const + ", '" + type_str + "', '" + hash + "', " +
+            to_string(counts.string) + ", " +
+            to_string(counts.date_time) + ", " +
+            to_string(counts.number) + ", " +
+            to_string(counts.integer) + ", " +
+            to_string(counts.floating) + ", " +
+            to_string(counts.boolean) + ", " +
+            to_string(counts.null) + ", " +
+            to_string(counts.uuid) + ", " +
+            to_string(counts.max_length) + ", " + now + ")";
     }
+    sql += ";";
+    lg->detail(sql);
+    { etymon::pgconn_result r(conn, sql); }
+}
 
-    if (opt.load_from_dir != "") {
-        string path;
-        compose_data_file_path(load_dir, *table, "", "_test.json", &path);
-        if (fs::exists(path)) {
-            lg->write(log_level::detail, "", "", "staging: " + table->name + ": analyze: test file", -1);
-            stage_page(opt, lg, 1, *table, conn, *dbt, &stats,
-                       path, read_buffer, sizeof read_buffer,
-                       drop_fields);
-        }
+static void append_table_list(const map<string, vector<string>>& lists,
+                              const string& table_name, string* str)
+{
+    auto l = lists.find(table_name);
+    if (l != lists.end()) {
+        for (const auto& s : l->second)
+            *str += s + ",";
     }
+    *str += ";";
+}
 
+// The fingerprint of a table combines the fingerprint of its records
+// with the table schema and the settings that affect the stored data.
+// The indexing and logging settings, which affect how the table is
+// built, are included as a digest.
+static void compose_fingerprint(const ldp_options& opt,
+                                const table_schema& table,
+                                const table_fingerprint& fingerprint,
+                                string* str)
+{
+    string columns, hash, records;
+    table.describe_columns(&columns, &hash);
+    fingerprint.finish(&records);
+
+    string settings = string(opt.advise_indexes ? "a" : "i") +
+        (opt.index_large_varchar ? "v" : "n") +
+        (opt.unlogged_loading_tables ? "u" : "l") +
+        (opt.keep_tables_unlogged ? "k" : "l") + ";";
+    append_table_list(opt.index_columns, table.name, &settings);
+    append_table_list(opt.no_index_columns, table.name, &settings);
+    append_table_list(opt.jsonb_indexes, table.name, &settings);
+    record_digest digest;
+    digest.update(settings.data(), settings.length());
+    string settings_hex;
+    digest.finish(&settings_hex);
+
+    *str = hash + ":" + records + ":" +
+        (opt.compact_json ? "c" : "p") + (opt.jsonb ? "b" : "j") +
+        (opt.record_history ? "h" : "n") + ":" + settings_hex;
+}
+
+/* *
+ * \brief Adds a column to a table for each top-level field in the type
+ * statistics collected by the first pass.
+ *
+ * \retval false The data types of a field are inconsistent, which is
+ * logged as an error.
+ */
+bool select_columns(ldp_log* lg, const map<string,type_counts>& stats,
+                    table_schema* table)
+{
     for (const auto& [field, counts] : stats) {
         lg->write(log_level::detail, "", "",
                   "Stats: in field: " + field, -1);
@@ -852,6 +1316,9 @@ bool stage_table_1(const ldp_options& opt,
         string type_str;
         column_schema::type_to_string(column.type, &type_str);
         column.length = max( (unsigned int) 1, counts.max_length);
+        // Allow for longer strings in pages that were not analyzed.
+        if (table->sampled && column.type == column_type::varchar)
+            column.length *= 2;
         string newattr;
         decode_camel_case(field.c_str(), &newattr);
         lg->write(log_level::detail, "", "",
@@ -859,14 +1326,31 @@ bool stage_table_1(const ldp_options& opt,
                   -1);
         column.name = newattr;
         column.source_name = field;
+        column.counts = counts;
         table->columns.push_back(column);
     }
-    create_loading_table(opt, lg, *table, conn, *dbt);
-
     return true;
 }
 
-bool stage_table_2(const ldp_options& opt,
+/* *
+ * \brief Collects type statistics from one page of records, as in the
+ * first pass of stage_table_1().
+ */
+void analyze_page(const ldp_options& opt, const table_schema& table,
+                  const field_set& drop_fields, const string& filename,
+                  type_statistics* stats)
+{
+    record_arena arena;
+    record_filter filter(table, drop_fields,
+                         !opt.jsonb || record_digests(opt, table));
+    dbtype dbt(nullptr);
+    vector<char> read_buffer(65536);
+    stage_page(opt, nullptr, 1, table, nullptr, dbt, stats, nullptr,
+               filename, read_buffer.data(), read_buffer.size(), filter,
+               nullptr, &arena);
+}
+
+bool stage_table_1(const ldp_options& opt,
                    const vector<source_state>& source_states,
                    ldp_log* lg,
                    table_schema* table,
@@ -874,9 +1358,17 @@ bool stage_table_2(const ldp_options& opt,
                    dbtype* dbt,
                    const string& load_dir,
                    field_set* drop_fields,
-                   char* read_buffer)
+                   char* read_buffer, int sample_percent)
 {
-    map<string,type_counts> stats;
+    type_statistics type_stats;
+    table_fingerprint fingerprint;
+    table->sampled = false;
+    table->fingerprint.clear();
+    record_arena arena;
+    // JSONB values are compared independently of member order, but
+    // digests require a normalized order.
+    record_filter filter(*table, *drop_fields,
+                         !opt.jsonb || record_digests(opt, *table));
 
     for (auto& state : source_states) {
         size_t page_count = read_page_count(state.source, lg, load_dir,
@@ -887,13 +1379,17 @@ bool stage_table_2(const ldp_options& opt,
                   to_string(page_count), -1);
 
         for (size_t page = 0; page < page_count; page++) {
+            if (!sample_page(page, page_count, sample_percent)) {
+                table->sampled = true;
+                continue;
+            }
             string path;
             compose_data_file_path(load_dir, *table, state.source.source_name,
                                    "_" + to_string(page) + ".json", &path);
-            lg->write(log_level::detail, "", "", "staging: " + table->name + ": load: page: " + to_string(page), -1);
-            stage_page(opt, lg, 2, *table, conn, *dbt, &stats, path,
-                       read_buffer, sizeof read_buffer,
-                       drop_fields);
+            lg->write(log_level::detail, "", "", "staging: " + table->name + ": analyze: page: " + to_string(page), -1);
+            stage_page(opt, lg, 1, *table, nullptr, *dbt, &type_stats,
+                       &fingerprint, path,
+                       read_buffer, sizeof read_buffer, filter, nullptr, &arena);
         }
     }
 
@@ -901,12 +1397,103 @@ bool stage_table_2(const ldp_options& opt,
         string path;
         compose_data_file_path(load_dir, *table, "", "_test.json", &path);
         if (fs::exists(path)) {
-            lg->write(log_level::detail, "", "", "staging: " + table->name + ": load: test file", -1);
-            stage_page(opt, lg, 2, *table, conn, *dbt, &stats,
-                       path, read_buffer, sizeof read_buffer,
-                       drop_fields);
+            lg->write(log_level::detail, "", "", "staging: " + table->name + ": analyze: test file", -1);
+            stage_page(opt, lg, 1, *table, nullptr, *dbt, &type_stats,
+                       &fingerprint, path, read_buffer, sizeof read_buffer,
+                       filter, nullptr, &arena);
         }
     }
 
+    map<string,type_counts> stats;
+    type_stats.sorted_counts(&stats);
+    if (!select_columns(lg, stats, table))
+        return false;
+    save_table_schema(lg, *table, stats, conn, *dbt);
+    if (!table->sampled)
+        compose_fingerprint(opt, *table, fingerprint, &(table->fingerprint));
+    create_loading_table(opt, lg, *table, conn, *dbt);
+
+    return true;
+}
+
+bool stage_table_2(const ldp_options& opt,
+                   const vector<source_state>& source_states,
+                   ldp_log* lg,
+                   table_schema* table,
+                   etymon::pgconn* conn,
+                   dbtype* dbt,
+                   const string& load_dir,
+                   field_set* drop_fields,
+                   char* read_buffer)
+{
+    record_arena arena;
+    // JSONB values are compared independently of member order, but
+    // digests require a normalized order.
+    record_filter filter(*table, *drop_fields,
+                         !opt.jsonb || record_digests(opt, *table));
+
+    // Digests are written to a temporary file, and loaded into their
+    // own table after the records.
+    unique_ptr<FILE, int (*)(FILE*)> digests(nullptr, fclose);
+    if (record_digests(opt, *table)) {
+        digests.reset(tmpfile());
+        if (digests == nullptr)
+            throw runtime_error("unable to create temporary file for "
+                                "record digests");
+        arena.digests = digests.get();
+    }
+
+    // All pages are loaded in a single COPY, with the parser and the
+    // sender thread alternating between two buffers.
+    begin_copy(*table, conn);
+    string copy_buffer;
+    copy_buffer.reserve(copy_buffer_size);
+    try {
+        copy_sender sender(conn);
+
+        for (auto& state : source_states) {
+            size_t page_count = read_page_count(state.source, lg, load_dir,
+                                                table->name);
+
+            lg->write(log_level::detail, "", "",
+                      "staging: " + table->name + ": page count: " +
+                      to_string(page_count), -1);
+
+            for (size_t page = 0; page < page_count; page++) {
+                string path;
+                compose_data_file_path(load_dir, *table,
+                                       state.source.source_name,
+                                       "_" + to_string(page) + ".json", &path);
+                lg->write(log_level::detail, "", "", "staging: " + table->name + ": load: page: " + to_string(page), -1);
+                stage_page(opt, lg, 2, *table, &sender, *dbt, nullptr,
+                           nullptr, path,
+                           read_buffer, sizeof read_buffer,
+                           filter, &copy_buffer, &arena);
+            }
+        }
+
+        if (opt.load_from_dir != "") {
+            string path;
+            compose_data_file_path(load_dir, *table, "", "_test.json", &path);
+            if (fs::exists(path)) {
+                lg->write(log_level::detail, "", "", "staging: " + table->name + ": load: test file", -1);
+                stage_page(opt, lg, 2, *table, &sender, *dbt, nullptr,
+                           nullptr, path, read_buffer, sizeof read_buffer,
+                           filter, &copy_buffer, &arena);
+            }
+        }
+
+        if (!copy_buffer.empty())
+            sender.send(&copy_buffer);
+        sender.finish();
+    } catch (sample_mismatch& e) {
+        abort_copy(conn, e.what());
+        throw;
+    }
+    end_copy(conn);
+
+    if (digests != nullptr)
+        load_digests(opt, lg, *table, digests.get(), conn, *dbt);
+
     return true;
 }
@@ -1,16 +1,50 @@
 #ifndef LDP_STAGE_H
 #define LDP_STAGE_H
 
+#include <map>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_set>
+
 #include "anonymize.h"
 #include "options.h"
+#include "schema.h"
 #include "util.h"
 
+/* *
+ * \brief Thrown by stage_table_2() if a value does not fit the column
+ * type that was inferred from a sample of the data.
+ *
+ * The loading table is then invalid, and the table should be analyzed
+ * again without sampling.
+ */
+class sample_mismatch : public runtime_error {
+public:
+    using runtime_error::runtime_error;
+};
+
+bool sample_page(size_t page, size_t page_count, int sample_percent);
+
+void column_source_names(const table_schema& table,
+                         unordered_set<string_view>* columns);
+
+bool is_unsampled_field(const unordered_set<string_view>& columns,
+                        const field_node* drop_fields,
+                        const char* name, size_t length);
+
+bool select_columns(ldp_log* lg, const map<string,type_counts>& stats,
+                    table_schema* table);
+
+void analyze_page(const ldp_options& opt, const table_schema& table,
+                  const field_set& drop_fields, const string& filename,
+                  type_statistics* stats);
+
 bool stage_table_1(const ldp_options& opt,
                    const vector<source_state>& source_states,
                    ldp_log* lg, table_schema* table,
                    etymon::pgconn* conn, dbtype* dbt, const string& loadDir,
                    field_set* drop_fields,
-                   char* read_buffer);
+                   char* read_buffer, int sample_percent);
 
 bool stage_table_2(const ldp_options& opt,
                    const vector<source_state>& source_states,
@@ -19,7 +53,5 @@ bool stage_table_2(const ldp_options& opt,
                    field_set* drop_fields,
                    char* read_buffer);
 
-void index_loaded_table(ldp_log* lg, const table_schema& table, etymon::pgconn* conn, dbtype* dbt, bool index_large_varchar);
-
 #endif
 
@@ -0,0 +1,207 @@
+#include "strclass.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define LDP_STRCLASS_X86
+#include <immintrin.h>
+#endif
+
+// Templates for the fixed-format prefixes.  In a template, 'x' matches
+// a hexadecimal digit, 'd' matches a decimal digit, and any other
+// character matches itself.
+static const char uuid_template[] = "xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx";
+static const char date_time_template[] = "dddd-dd-ddTdd:dd:dd";
+
+constexpr size_t uuid_length = sizeof uuid_template - 1;
+constexpr size_t date_time_length = sizeof date_time_template - 1;
+
+static bool match_template(const char* str, const char* tmpl, size_t length)
+{
+    for (size_t x = 0; x < length; x++) {
+        char c = str[x];
+        switch (tmpl[x]) {
+        case 'x':
+            if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') ||
+                        (c >= 'A' && c <= 'F')))
+                return false;
+            break;
+        case 'd':
+            if (!(c >= '0' && c <= '9'))
+                return false;
+            break;
+        default:
+            if (c != tmpl[x])
+                return false;
+        }
+    }
+    return true;
+}
+
+/* *
+ * \brief Classifies a string without using vector instructions.
+ *
+ * This is the reference implementation, and it is used on platforms
+ * where the vectorized kernels are not available.
+ *
+ * \param[in] str The string, which need not be null-terminated.
+ * \param[in] length Length of the string in bytes.
+ * \param[out] cls The classification.
+ */
+void classify_string_scalar(const char* str, size_t length,
+                            string_class* cls)
+{
+    cls->length = length;
+    cls->uuid = (length == uuid_length &&
+                 match_template(str, uuid_template, uuid_length));
+    cls->date_time = (length >= date_time_length &&
+                      match_template(str, date_time_template,
+                                     date_time_length));
+}
+
+#ifdef LDP_STRCLASS_X86
+
+// Each of the following returns a vector with 0xff in the bytes of c
+// that match the corresponding bytes of the template t.  Since the
+// comparisons are signed, bytes >= 0x80 never fall within a range.
+
+static inline __m128i sse2_in_range(__m128i c, char lo, char hi)
+{
+    return _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8(lo - 1)),
+                         _mm_cmplt_epi8(c, _mm_set1_epi8(hi + 1)));
+}
+
+static inline __m128i sse2_match_uuid(__m128i c, __m128i t)
+{
+    __m128i hex = _mm_or_si128(
+            sse2_in_range(c, '0', '9'),
+            sse2_in_range(_mm_or_si128(c, _mm_set1_epi8(0x20)), 'a', 'f'));
+    __m128i mask = _mm_cmpeq_epi8(t, _mm_set1_epi8('x'));
+    return _mm_or_si128(_mm_and_si128(mask, hex),
+                        _mm_andnot_si128(mask, _mm_cmpeq_epi8(c, t)));
+}
+
+static inline __m128i sse2_match_date_time(__m128i c, __m128i t)
+{
+    __m128i digit = sse2_in_range(c, '0', '9');
+    __m128i mask = _mm_cmpeq_epi8(t, _mm_set1_epi8('d'));
+    return _mm_or_si128(_mm_and_si128(mask, digit),
+                        _mm_andnot_si128(mask, _mm_cmpeq_epi8(c, t)));
+}
+
+static inline __m128i sse2_load(const char* p)
+{
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+
+// The date-time prefix is 19 bytes, so it is checked as two
+// overlapping 16-byte blocks at offsets 0 and 3.
+static inline bool sse2_date_time(const char* str)
+{
+    __m128i m = _mm_and_si128(
+            sse2_match_date_time(sse2_load(str),
+                                 sse2_load(date_time_template)),
+            sse2_match_date_time(sse2_load(str + 3),
+                                 sse2_load(date_time_template + 3)));
+    return _mm_movemask_epi8(m) == 0xffff;
+}
+
+// A UUID is 36 bytes, checked as blocks at offsets 0, 16 and 20.
+static void classify_string_sse2(const char* str, size_t length,
+                                 string_class* cls)
+{
+    cls->length = length;
+    if (length == uuid_length) {
+        __m128i m = _mm_and_si128(
+                _mm_and_si128(
+                    sse2_match_uuid(sse2_load(str),
+                                    sse2_load(uuid_template)),
+                    sse2_match_uuid(sse2_load(str + 16),
+                                    sse2_load(uuid_template + 16))),
+                sse2_match_uuid(sse2_load(str + 20),
+                                sse2_load(uuid_template + 20)));
+        cls->uuid = (_mm_movemask_epi8(m) == 0xffff);
+    } else {
+        cls->uuid = false;
+    }
+    cls->date_time = (length >= date_time_length && sse2_date_time(str));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_in_range(__m256i c, char lo, char hi)
+{
+    return _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8(lo - 1)),
+                            _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), c));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_match_uuid(__m256i c, __m256i t)
+{
+    __m256i hex = _mm256_or_si256(
+            avx2_in_range(c, '0', '9'),
+            avx2_in_range(_mm256_or_si256(c, _mm256_set1_epi8(0x20)),
+                          'a', 'f'));
+    __m256i mask = _mm256_cmpeq_epi8(t, _mm256_set1_epi8('x'));
+    return _mm256_or_si256(
+            _mm256_and_si256(mask, hex),
+            _mm256_andnot_si256(mask, _mm256_cmpeq_epi8(c, t)));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_load(const char* p)
+{
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+}
+
+// A UUID is checked as two overlapping 32-byte blocks at offsets 0 and
+// 4.  The date-time prefix is shorter than 32 bytes and uses the
+// 128-bit kernel, which is encoded with VEX in this function.
+__attribute__((target("avx2")))
+static void classify_string_avx2(const char* str, size_t length,
+                                 string_class* cls)
+{
+    cls->length = length;
+    if (length == uuid_length) {
+        __m256i m = _mm256_and_si256(
+                avx2_match_uuid(avx2_load(str), avx2_load(uuid_template)),
+                avx2_match_uuid(avx2_load(str + 4),
+                                avx2_load(uuid_template + 4)));
+        cls->uuid = (_mm256_movemask_epi8(m) == -1);
+    } else {
+        cls->uuid = false;
+    }
+    cls->date_time = (length >= date_time_length && sse2_date_time(str));
+}
+
+#endif
+
+typedef void (*classify_kernel)(const char*, size_t, string_class*);
+
+static classify_kernel select_kernel()
+{
+#ifdef LDP_STRCLASS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return classify_string_avx2;
+    return classify_string_sse2;
+#else
+    return classify_string_scalar;
+#endif
+}
+
+static const classify_kernel kernel = select_kernel();
+
+/* *
+ * \brief Classifies a string as a UUID and/or ISO 8601 date-time.
+ *
+ * A string is a UUID if it consists of exactly 32 hexadecimal digits
+ * in groups of 8-4-4-4-12 separated by hyphens.  It is a date-time if
+ * it begins with a prefix of the form YYYY-MM-DDThh:mm:ss.  The fastest
+ * kernel supported by the CPU is selected at startup.
+ *
+ * \param[in] str The string, which need not be null-terminated.
+ * \param[in] length Length of the string in bytes.
+ * \param[out] cls The classification.
+ */
+void classify_string(const char* str, size_t length, string_class* cls)
+{
+    kernel(str, length, cls);
+}
@@ -0,0 +1,22 @@
+#ifndef LDP_STRCLASS_H
+#define LDP_STRCLASS_H
+
+#include <cstddef>
+
+/* *
+ * \brief Classification of a JSON string value, used for type
+ * inference.
+ */
+class string_class {
+public:
+    bool uuid = false;
+    bool date_time = false;
+    size_t length = 0;
+};
+
+void classify_string(const char* str, size_t length, string_class* cls);
+
+void classify_string_scalar(const char* str, size_t length,
+                            string_class* cls);
+
+#endif
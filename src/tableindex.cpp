@@ -0,0 +1,348 @@
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+
+#include "tableindex.h"
+#include "util.h"
+
+static void plan_primary_key(const table_schema& table, index_plan* plan)
+{
+    plan->primary_key =
+        "ALTER TABLE " + table.name + "\n"
+        "    ADD PRIMARY KEY (id);";
+}
+
+/* *
+ * \brief Records the usage of the indexes on the current version of a
+ * table, before it is replaced.
+ *
+ * Index scans are counted by the server from the time the table was
+ * created, i.e. since the previous update.  The totals are kept in
+ * dbsystem.index_usage together with the number of consecutive updates
+ * after which an index had not been scanned, which continues to count
+ * the updates in which the index advisor left out an unused index.
+ * This should be run in the staging transaction so that the usage is
+ * recorded only once.
+ */
+void record_index_usage(const ldp_options& opt, ldp_log* lg,
+                        const string& table_name, etymon::pgconn* conn,
+                        const dbtype& dbt, index_usage* usage)
+{
+    usage->columns.clear();
+    if (dbt.type() != dbsys::postgresql)
+        return;
+
+    string sql =
+        "SELECT column_name, index_scans, unused_updates\n"
+        "    FROM dbsystem.index_usage\n"
+        "    WHERE table_name = '" + table_name + "';";
+    lg->detail(sql);
+    {
+        etymon::pgconn_result r(conn, sql);
+        for (int x = 0; x < PQntuples(r.result); x++) {
+            column_usage& u = usage->columns[PQgetvalue(r.result, x, 0)];
+            u.index_scans = stoll(PQgetvalue(r.result, x, 1));
+            u.unused_updates = stoi(PQgetvalue(r.result, x, 2));
+        }
+    }
+
+    // Single-column indexes other than the primary key.  Expression
+    // indexes have no attribute number and are not matched.
+    sql =
+        "SELECT a.attname, sum(s.idx_scan)\n"
+        "    FROM pg_stat_user_indexes AS s\n"
+        "        JOIN pg_index AS i ON s.indexrelid = i.indexrelid\n"
+        "        JOIN pg_attribute AS a\n"
+        "            ON i.indrelid = a.attrelid AND i.indkey[0] = a.attnum\n"
+        "    WHERE s.schemaname = 'public' AND\n"
+        "          s.relname = '" + table_name + "' AND\n"
+        "          i.indnatts = 1 AND\n"
+        "          NOT i.indisprimary\n"
+        "    GROUP BY a.attname;";
+    lg->detail(sql);
+    {
+        etymon::pgconn_result r(conn, sql);
+        for (int x = 0; x < PQntuples(r.result); x++) {
+            column_usage& u = usage->columns[PQgetvalue(r.result, x, 0)];
+            int64_t scans = stoll(PQgetvalue(r.result, x, 1));
+            u.indexed = true;
+            u.index_scans += scans;
+            u.unused_updates = (scans > 0 ? 0 : u.unused_updates + 1);
+        }
+    }
+    for (auto& [column, u] : usage->columns) {
+        if (!u.indexed && u.unused_updates >= opt.index_unused_updates)
+            u.unused_updates++;
+    }
+
+    sql =
+        "SELECT attname, n_distinct\n"
+        "    FROM pg_stats\n"
+        "    WHERE schemaname = 'public' AND\n"
+        "          tablename = '" + table_name + "';";
+    lg->detail(sql);
+    {
+        etymon::pgconn_result r(conn, sql);
+        for (int x = 0; x < PQntuples(r.result); x++) {
+            auto u = usage->columns.find(PQgetvalue(r.result, x, 0));
+            if (u != usage->columns.end())
+                u->second.n_distinct = stod(PQgetvalue(r.result, x, 1));
+        }
+    }
+
+    sql =
+        "DELETE FROM dbsystem.index_usage\n"
+        "    WHERE table_name = '" + table_name + "';";
+    lg->detail(sql);
+    { etymon::pgconn_result r(conn, sql); }
+    if (usage->columns.empty())
+        return;
+    string now = dbt.current_timestamp();
+    sql =
+        "INSERT INTO dbsystem.index_usage\n"
+        "    (table_name, column_name, index_scans, unused_updates, updated)\n"
+        "    VALUES\n";
+    bool first = true;
+    for (const auto& [column, u] : usage->columns) {
+        string column_const;
+        dbt.encode_string_const(column.c_str(), &column_const);
+        if (!first)
+            sql += ",\n";
+        first = false;
+        sql += "    ('" + table_name + "', " + column_const + ", " +
+            to_string(u.index_scans) + ", " + to_string(u.unused_updates) +
+            ", " + now + ")";
+    }
+    sql += ";";
+    lg->detail(sql);
+    { etymon::pgconn_result r(conn, sql); }
+}
+
+static bool list_contains(const map<string, vector<string>>& lists,
+                          const string& table_name, const string& column_name)
+{
+    auto l = lists.find(table_name);
+    return l != lists.end() &&
+        find(l->second.begin(), l->second.end(), column_name) !=
+        l->second.end();
+}
+
+// Columns with fewer distinct values than this are not worth indexing.
+static const double advisor_min_distinct = 3;
+
+/* *
+ * \brief Decides whether the index advisor leaves a column unindexed.
+ *
+ * The decision uses the type statistics from analyzing the data, the
+ * planner statistics of the previous version of the table, and the
+ * recorded usage of the column's index.
+ */
+static bool advise_no_index(const ldp_options& opt,
+                            const column_schema& column,
+                            const index_usage& usage, string* reason)
+{
+    const type_counts& c = column.counts;
+    if (c.string + c.number + c.boolean == 0) {
+        *reason = "no values";
+        return true;
+    }
+    if (column.type == column_type::boolean) {
+        *reason = "boolean";
+        return true;
+    }
+    auto u = usage.columns.find(column.name);
+    if (u == usage.columns.end())
+        return false;
+    // A negative n_distinct is a fraction of the number of rows.
+    if (u->second.n_distinct > 0 &&
+            u->second.n_distinct < advisor_min_distinct) {
+        *reason = "low cardinality";
+        return true;
+    }
+    // An index unused in index_unused_updates updates is left out for
+    // that many updates, and then created again for one update to see
+    // whether it is used.
+    int n = opt.index_unused_updates;
+    int unused = u->second.unused_updates;
+    if (unused >= n && (unused - n) % (n + 1) < n) {
+        *reason = "index unused in " + to_string(unused) + " updates";
+        return true;
+    }
+    return false;
+}
+
+static void plan_column_indexes(const ldp_options& opt,
+                                const table_schema& table,
+                                const dbtype& dbt, const index_usage& usage,
+                                index_plan* plan)
+{
+    for (const auto& column : table.columns) {
+        if (column.name == "id") {
+            plan_primary_key(table, plan);
+            continue;
+        }
+        // in postgres, index columns except column "data"
+        if (dbt.type() != dbsys::postgresql || column.name == "data")
+            continue;
+        if (list_contains(opt.no_index_columns, table.name, column.name))
+            continue;
+        bool required = list_contains(opt.index_columns, table.name,
+                                      column.name);
+        string reason;
+        if (opt.advise_indexes && !required &&
+                advise_no_index(opt, column, usage, &reason)) {
+            plan->skipped.push_back(column.name + " (" + reason + ")");
+            continue;
+        }
+        // The advisor indexes mostly null columns with partial indexes.
+        const type_counts& c = column.counts;
+        string where;
+        if (opt.advise_indexes && c.null > c.string + c.number + c.boolean)
+            where = " WHERE \"" + column.name + "\" IS NOT NULL";
+        index_definition index;
+        // create btree index unless column is a large varchar
+        if (column.type == column_type::varchar && column.length > 500) {
+            // create hash index if index_large_varchar is enabled
+            if (!opt.index_large_varchar && !required)
+                continue;
+            index.sql = "CREATE INDEX ON " + table.name + " USING HASH (\"" + column.name + "\")" + where + ";";
+            index.failure = "Unable to create hash index: table=" + table.name + " column=" + column.name;
+        } else {
+            index.sql = "CREATE INDEX ON " + table.name + " (\"" + column.name + "\")" + where + ";";
+            index.failure = "Unable to create B-tree index: table=" + table.name + " column=" + column.name;
+        }
+        plan->indexes.push_back(index);
+    }
+}
+
+// GIN indexes on paths of the form "/a/b" within the JSONB data column,
+// each indexed as the expression (data->'a'->'b').  The path "/"
+// indexes the entire column.
+static void plan_jsonb_indexes(const ldp_options& opt,
+                               const table_schema& table,
+                               const dbtype& dbt, index_plan* plan)
+{
+    if (!opt.jsonb || dbt.type() != dbsys::postgresql)
+        return;
+    auto paths = opt.jsonb_indexes.find(table.name);
+    if (paths == opt.jsonb_indexes.end())
+        return;
+    for (const auto& path : paths->second) {
+        string expr = "data";
+        bool valid = (!path.empty() && path[0] == '/');
+        size_t start = 1;
+        while (valid && start < path.length()) {
+            size_t end = path.find('/', start);
+            if (end == string::npos)
+                end = path.length();
+            string element = path.substr(start, end - start);
+            // Allow only identifier characters, so that the element can
+            // be used as a string constant without escaping.
+            if (element.empty() ||
+                    element.find_first_not_of(
+                        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"
+                        "0123456789_") != string::npos) {
+                valid = false;
+                break;
+            }
+            expr += "->'" + element + "'";
+            start = end + 1;
+        }
+        index_definition index;
+        if (valid) {
+            index.sql = "CREATE INDEX ON " + table.name + " USING GIN ((" +
+                expr + "));";
+            index.failure = "Unable to create GIN index: table=" + table.name + " path=" + path;
+        } else {
+            // An empty statement is reported as a failure.
+            index.failure = "Invalid JSONB index path: table=" + table.name + " path=" + path;
+        }
+        plan->indexes.push_back(index);
+    }
+}
+
+/* *
+ * \brief Plans the primary key and indexes of a loaded table.
+ */
+void plan_table_indexes(const ldp_options& opt, const table_schema& table,
+                        const dbtype& dbt, const index_usage& usage,
+                        index_plan* plan)
+{
+    plan->primary_key.clear();
+    plan->indexes.clear();
+    plan->skipped.clear();
+    // If there is no table schema, define a primary key on (id).
+    if (table.columns.size() == 0)
+        plan_primary_key(table, plan);
+    else
+        plan_column_indexes(opt, table, dbt, usage, plan);
+    plan_jsonb_indexes(opt, table, dbt, plan);
+}
+
+static bool create_index(const index_definition& index, etymon::pgconn* conn)
+{
+    if (index.sql.empty())
+        return false;
+    try {
+        { etymon::pgconn_result r(conn, index.sql); }
+    } catch (runtime_error& e) {
+        return false;
+    }
+    return true;
+}
+
+/* *
+ * \brief Creates the indexes in a plan.
+ *
+ * After the primary key has been added, the other indexes are built
+ * concurrently over up to index_connections database connections,
+ * including the given one.  Failures are logged as warnings.
+ */
+void build_indexes(const ldp_options& opt, ldp_log* lg,
+                   const index_plan& plan, etymon::pgconn* conn)
+{
+    if (!plan.primary_key.empty()) {
+        lg->detail(plan.primary_key);
+        try {
+            { etymon::pgconn_result r(conn, plan.primary_key); }
+        } catch (runtime_error& e) {
+            lg->write(log_level::warning, "server", "", e.what(), -1);
+        }
+    }
+    for (const auto& index : plan.indexes)
+        lg->detail(index.sql);
+
+    vector<unique_ptr<etymon::pgconn>> pool;
+    vector<etymon::pgconn*> conns;
+    open_connection_pool(opt, lg,
+                         min((size_t) opt.index_connections,
+                             plan.indexes.size()),
+                         conn, &pool, &conns);
+
+    // Each connection takes the next index in the plan until none
+    // remain.
+    vector<char> created(plan.indexes.size(), false);
+    run_on_connections(conns, plan.indexes.size(),
+                       [&](etymon::pgconn* c, size_t x) {
+                           created[x] = create_index(plan.indexes[x], c);
+                       });
+
+    for (size_t x = 0; x < plan.indexes.size(); x++) {
+        if (!created[x])
+            lg->write(log_level::warning, "server", "",
+                      plan.indexes[x].failure, -1);
+    }
+}
+
+void index_loaded_table(const ldp_options& opt, ldp_log* lg,
+                        const table_schema& table, etymon::pgconn* conn,
+                        const dbtype& dbt, const index_usage& usage)
+{
+    lg->detail("creating indexes: " + table.name);
+    index_plan plan;
+    plan_table_indexes(opt, table, dbt, usage, &plan);
+    for (const auto& s : plan.skipped)
+        lg->write(log_level::trace, "", "",
+                  table.name + ": index advisor skipped column: " + s, -1);
+    build_indexes(opt, lg, plan, conn);
+}
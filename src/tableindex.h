@@ -0,0 +1,76 @@
+#ifndef LDP_TABLEINDEX_H
+#define LDP_TABLEINDEX_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../etymoncpp/include/postgres.h"
+#include "dbtype.h"
+#include "log.h"
+#include "options.h"
+#include "schema.h"
+
+using namespace std;
+
+class index_definition {
+public:
+    string sql;
+    // Warning to log if the index cannot be created
+    string failure;
+};
+
+/* *
+ * \brief Indexes to be created on a table after it has been loaded.
+ *
+ * The primary key is added first, since it locks the table
+ * exclusively.  The other indexes can then be built concurrently.
+ */
+class index_plan {
+public:
+    string primary_key;
+    vector<index_definition> indexes;
+    // Columns not indexed by the index advisor, with the reasons
+    vector<string> skipped;
+};
+
+class column_usage {
+public:
+    // The column was indexed in the previous version of the table.
+    bool indexed = false;
+    // Index scans recorded over all previous versions
+    int64_t index_scans = 0;
+    // Consecutive updates after which the index had not been used,
+    // including updates in which it was not created
+    int unused_updates = 0;
+    // Estimated number of distinct values (pg_stats.n_distinct), or 0
+    // if unknown
+    double n_distinct = 0;
+};
+
+/* *
+ * \brief Usage of the indexes on a table, collected before the table is
+ * replaced.
+ */
+class index_usage {
+public:
+    map<string, column_usage> columns;
+};
+
+void record_index_usage(const ldp_options& opt, ldp_log* lg,
+                        const string& table_name, etymon::pgconn* conn,
+                        const dbtype& dbt, index_usage* usage);
+
+void plan_table_indexes(const ldp_options& opt, const table_schema& table,
+                        const dbtype& dbt, const index_usage& usage,
+                        index_plan* plan);
+
+void build_indexes(const ldp_options& opt, ldp_log* lg,
+                   const index_plan& plan, etymon::pgconn* conn);
+
+void index_loaded_table(const ldp_options& opt, ldp_log* lg,
+                        const table_schema& table, etymon::pgconn* conn,
+                        const dbtype& dbt, const index_usage& usage);
+
+#endif
@@ -5,6 +5,7 @@
 #include <experimental/filesystem>
 #include <iostream>
 #include <map>
+#include <set>
 #include <stdexcept>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -18,10 +19,14 @@
 #include "extract.h"
 #include "init.h"
 #include "log.h"
+#include "maintenance.h"
 #include "merge.h"
+#include "names.h"
 #include "stage.h"
+#include "tableindex.h"
 #include "timer.h"
 #include "update.h"
+#include "util.h"
 
 namespace fs = std::experimental::filesystem;
 
@@ -35,25 +40,6 @@ void make_update_tmp_dir(const ldp_options& opt, string* loaddir)
     *loaddir = tmppath;
 }
 
-bool is_foreign_key(etymon::pgconn* conn, ldp_log* lg,
-        const table_schema& table2, const column_schema& column2,
-        const table_schema& table1)
-{
-    string sql =
-        "SELECT 1\n"
-        "    FROM " + table2.name + " AS r2\n"
-        "        JOIN " + table1.name + " AS r1\n"
-        "            ON r2." + column2.name + " = r1.id\n"
-        "    LIMIT 1;";
-    lg->detail(sql);
-    try {
-        etymon::pgconn_result r(conn, sql);
-        return PQntuples(r.result) > 0;
-    } catch (runtime_error& e) {
-        return false;
-    }
-}
-
 class reference {
 public:
     string referencing_table;
@@ -63,44 +49,91 @@ public:
     string constraint_name;
 };
 
-void search_table_foreign_keys(const ldp_options& opt,
-                               etymon::pgconn* conn, ldp_log* lg,
-                               const ldp_schema& schema,
-                               const table_schema& table,
-                               bool detectForeignKeys,
-                               map<string, vector<reference>>* refs)
+/* *
+ * \brief Detects columns that reference the id of another table.
+ *
+ * The primary keys of all tables are first collected into a temporary
+ * table, with one scan of each table.  Then each candidate column is
+ * matched against all of the primary keys at once, with one query that
+ * scans the referencing table.  A separate connection is used so that
+ * errors, for example from a table that does not exist, do not abort
+ * the caller's transaction.
+ */
+void search_foreign_keys(const ldp_options& opt, ldp_log* lg,
+                         const ldp_schema& schema,
+                         map<string, vector<reference>>* refs)
 {
     etymon::pgconn query_conn(opt.dbinfo);
-    lg->detail("Searching for foreign keys in table: " + table.name);
-    //printf("Table: %s\n", table.name.c_str());
-    for (auto& column : table.columns) {
-        if (column.type != column_type::id)
-            continue;
-        if (column.name == "id")
+    dbtype dbt(&query_conn);
+
+    string sql =
+        "CREATE TEMPORARY TABLE foreign_key_targets (\n"
+        "    table_name VARCHAR(63) NOT NULL,\n"
+        "    id VARCHAR(36) NOT NULL\n"
+        ");";
+    lg->detail(sql);
+    { etymon::pgconn_result r(&query_conn, sql); }
+    for (auto& table : schema.tables) {
+        sql =
+            "INSERT INTO foreign_key_targets (table_name, id)\n"
+            "SELECT '" + table.name + "', id\n"
+            "    FROM " + table.name + ";";
+        lg->detail(sql);
+        try {
+            etymon::pgconn_result r(&query_conn, sql);
+        } catch (runtime_error& e) {
             continue;
-        //printf("    Column: %s\n", column.name.c_str());
-        for (auto& table1 : schema.tables) {
-            if (is_foreign_key(&query_conn, lg, table, column, table1)) {
+        }
+    }
+    if (dbt.type() == dbsys::postgresql) {
+        sql = "CREATE INDEX ON foreign_key_targets (id);";
+        lg->detail(sql);
+        { etymon::pgconn_result r(&query_conn, sql); }
+    }
+    sql = "ANALYZE foreign_key_targets;";
+    lg->detail(sql);
+    { etymon::pgconn_result r(&query_conn, sql); }
 
-                string key = table.name + "." + column.name;
+    for (auto& table : schema.tables) {
+        lg->detail("Searching for foreign keys in table: " + table.name);
+        for (auto& column : table.columns) {
+            if (column.type != column_type::id)
+                continue;
+            if (column.name == "id")
+                continue;
+            sql =
+                "SELECT DISTINCT t.table_name\n"
+                "    FROM ( SELECT DISTINCT " + column.name + " AS id\n"
+                "               FROM " + table.name + "\n"
+                "               WHERE " + column.name + " IS NOT NULL ) AS v\n"
+                "        JOIN foreign_key_targets AS t\n"
+                "            ON v.id = t.id\n"
+                "    ORDER BY t.table_name;";
+            lg->detail(sql);
+            vector<string> referenced_tables;
+            try {
+                etymon::pgconn_result r(&query_conn, sql);
+                for (int x = 0; x < PQntuples(r.result); x++)
+                    referenced_tables.push_back(PQgetvalue(r.result, x, 0));
+            } catch (runtime_error& e) {
+                continue;
+            }
+            string key = table.name + "." + column.name;
+            for (auto& referenced_table : referenced_tables) {
                 reference ref = {
                     table.name,
                     column.name,
-                    table1.name,
+                    referenced_table,
                     "id"
                 };
-
-                //fprintf(stderr, "%s(%s) -> %s(%s)\n",
-                //        ref.referencing_table.c_str(),
-                //        ref.referencing_column.c_str(),
-                //        ref.referenced_table.c_str(),
-                //        ref.referenced_column.c_str());
-
                 (*refs)[key].push_back(ref);
-
             }
         }
     }
+
+    sql = "DROP TABLE foreign_key_targets;";
+    lg->detail(sql);
+    { etymon::pgconn_result r(&query_conn, sql); }
 }
 
 void select_foreign_key_constraints(etymon::pgconn* conn, ldp_log* lg,
@@ -128,20 +161,40 @@ void select_foreign_key_constraints(etymon::pgconn* conn, ldp_log* lg,
     }
 }
 
-void remove_foreign_key_constraints(etymon::pgconn* conn, ldp_log* lg)
+static void drop_foreign_key_constraints(etymon::pgconn* conn, ldp_log* lg,
+                                         const vector<reference>& refs)
 {
-    vector<reference> refs;
-    select_foreign_key_constraints(conn, lg, &refs);
     for (auto& ref : refs) {
         string sql =
             "ALTER TABLE " + ref.referencing_table + "\n"
             "    DROP CONSTRAINT " + ref.constraint_name + " CASCADE;";
         lg->detail(sql);
         { etymon::pgconn_result r(conn, sql); }
+        sql =
+            "DELETE FROM dbsystem.foreign_key_constraints\n"
+            "    WHERE referencing_table = '" + ref.referencing_table + "' AND\n"
+            "          referencing_column = '" + ref.referencing_column + "';";
+        lg->detail(sql);
+        { etymon::pgconn_result r(conn, sql); }
     }
-    string sql = "DELETE FROM dbsystem.foreign_key_constraints;";
-    lg->detail(sql);
-    { etymon::pgconn_result r(conn, sql); }
+}
+
+/* *
+ * \brief Removes the foreign key constraints that reference or are
+ * defined on a table that is about to be replaced.  Constraints between
+ * other tables remain in place.
+ */
+void remove_foreign_key_constraints(etymon::pgconn* conn, ldp_log* lg,
+                                    const string& table_name)
+{
+    vector<reference> refs, table_refs;
+    select_foreign_key_constraints(conn, lg, &refs);
+    for (auto& ref : refs) {
+        if (ref.referencing_table == table_name ||
+                ref.referenced_table == table_name)
+            table_refs.push_back(ref);
+    }
+    drop_foreign_key_constraints(conn, lg, table_refs);
 }
 
 void select_enabled_foreign_keys(etymon::pgconn* conn, ldp_log* lg,
@@ -179,147 +232,573 @@ void make_foreign_key_constraint_name(const string& referencing_table,
     *constraint_name = string(p) + "_" + referencing_column + "_fk";
 }
 
-void log_foreign_key_warnings(const reference& ref,
+class foreign_key_check {
+public:
+    reference ref;
+    string constraint_name;
+    // Referencing rows whose foreign key is not present in the
+    // referenced table, as (primary key, foreign key)
+    vector<pair<string, string>> exceptions;
+    bool constrained = false;
+    bool invalid = false;
+    // Error from validating the constraint, if it was invalid
+    string validation_error;
+};
+
+static void log_error_detail(ldp_log* lg, const runtime_error& e)
+{
+    string s = e.what();
+    if ( !(s.empty()) && s.back() == '\n' )
+        s.pop_back();
+    lg->detail(s);
+}
+
+/* *
+ * \brief Returns the condition selecting rows of the referencing table
+ * whose foreign key is not present in the referenced table.
+ *
+ * This is an anti-join rather than NOT IN, which plans poorly for large
+ * sets and matches nothing if the referenced column contains NULL.
+ */
+static string foreign_key_exceptions_filter(const reference& ref)
+{
+    string column = ref.referencing_table + ".\"" +
+        ref.referencing_column + "\"";
+    return
+        "    WHERE " + column + " IS NOT NULL AND\n"
+        "          NOT EXISTS\n"
+        "            ( SELECT 1\n"
+        "                  FROM " + ref.referenced_table + " AS t\n"
+        "                  WHERE t.\"" + ref.referenced_column + "\" = " +
+        column + " )";
+}
+
+/* *
+ * \brief Selects the foreign key exceptions for a reference, and deletes
+ * the referencing rows if constraints are to be enforced.
+ */
+static void check_foreign_key(bool enable_foreign_key_warnings,
                               bool force_foreign_key_constraints,
-                              etymon::pgconn* conn, ldp_log* lg)
+                              etymon::pgconn* conn, ldp_log* lg,
+                              foreign_key_check* check)
 {
-    string sql;
-    try {
-        sql =
-            "SELECT referencing_pkey,\n"
-            "       referencing_fkey\n"
-            "    FROM temp_foreign_key_exceptions;";
+    const reference& ref = check->ref;
+    string filter = foreign_key_exceptions_filter(ref);
+    if (enable_foreign_key_warnings) {
+        string sql =
+            "SELECT id,\n"
+            "       \"" + ref.referencing_column + "\"\n"
+            "    FROM " + ref.referencing_table + "\n" + filter + ";";
         lg->detail(sql);
-        etymon::pgconn_result r(conn, sql);
-        int total = PQntuples(r.result);
-        for (int x = 0; x < total; x++) {
-            string pkey, fkey;
-            pkey = PQgetvalue(r.result, x, 0);
-            fkey = PQgetvalue(r.result, x, 1);
-            lg->write(log_level::warning, "foreign_key", ref.referenced_table,
-                "Foreign key is not present in referenced table:\n"
-                "    Referencing table: " + ref.referencing_table + "\n"
-                "    Referencing table primary key: " + pkey + "\n"
-                "    Referencing column: " + ref.referencing_column + "\n"
-                "    Referencing column foreign key: " + fkey + "\n"
-                "    Referenced table: " + ref.referenced_table + "\n"
-                "    Referenced column: " + ref.referenced_column + "\n"
-                "    Action: " +
-                ( force_foreign_key_constraints ?
-                  "Deleting row in referencing table" : "None" ), -1 );
+        try {
+            etymon::pgconn_result r(conn, sql);
+            for (int x = 0; x < PQntuples(r.result); x++)
+                check->exceptions.push_back({PQgetvalue(r.result, x, 0),
+                                             PQgetvalue(r.result, x, 1)});
+        } catch (runtime_error& e) {
+            log_error_detail(lg, e);
         }
-        
+    }
+    if (force_foreign_key_constraints) {
+        string sql =
+            "DELETE\n"
+            "    FROM " + ref.referencing_table + "\n" + filter + ";";
+        lg->detail(sql);
+        try {
+            etymon::pgconn_result r(conn, sql);
+        } catch (runtime_error& e) {
+            log_error_detail(lg, e);
+        }
+    }
+}
+
+static void log_foreign_key_warnings(const foreign_key_check& check,
+                                     bool force_foreign_key_constraints,
+                                     ldp_log* lg)
+{
+    const reference& ref = check.ref;
+    vector<string> messages;
+    for (const auto& [pkey, fkey] : check.exceptions) {
+        messages.push_back(
+            "Foreign key is not present in referenced table:\n"
+            "    Referencing table: " + ref.referencing_table + "\n"
+            "    Referencing table primary key: " + pkey + "\n"
+            "    Referencing column: " + ref.referencing_column + "\n"
+            "    Referencing column foreign key: " + fkey + "\n"
+            "    Referenced table: " + ref.referenced_table + "\n"
+            "    Referenced column: " + ref.referenced_column + "\n"
+            "    Action: " +
+            ( force_foreign_key_constraints ?
+              "Deleting row in referencing table" : "None" ) );
+    }
+    lg->write_all(log_level::warning, "foreign_key", ref.referenced_table,
+                  messages);
+}
+
+/* *
+ * \brief Groups checks by referencing table, so that the checks on a
+ * table are run in order on one connection while independent tables are
+ * processed concurrently.
+ */
+static void group_by_referencing_table(const vector<foreign_key_check>& checks,
+                                       vector<vector<size_t>>* groups)
+{
+    map<string, size_t> group_index;
+    groups->clear();
+    for (size_t x = 0; x < checks.size(); x++) {
+        const string& table = checks[x].ref.referencing_table;
+        auto g = group_index.find(table);
+        if (g == group_index.end()) {
+            g = group_index.insert({table, groups->size()}).first;
+            groups->push_back({});
+        }
+        (*groups)[g->second].push_back(x);
+    }
+}
+
+/* *
+ * \brief Orders groups of checks into levels, such that the tables
+ * referenced by a group are not modified by any group in the same or a
+ * later level.
+ *
+ * When constraints are enforced, a group deletes rows from its
+ * referencing table, which may leave rows in other tables without a
+ * referenced row.  Running the levels in order lets each group see the
+ * deletions that affect it, while the groups within a level run
+ * concurrently.  Groups whose tables reference each other in a cycle
+ * are placed in levels of their own and so are run one at a time.
+ */
+static void order_by_dependencies(const vector<foreign_key_check>& checks,
+                                  const vector<vector<size_t>>& groups,
+                                  vector<vector<size_t>>* levels)
+{
+    levels->clear();
+    set<string> pending;
+    for (const auto& group : groups)
+        pending.insert(checks[group[0]].ref.referencing_table);
+    vector<size_t> remaining(groups.size());
+    for (size_t g = 0; g < groups.size(); g++)
+        remaining[g] = g;
+    while (!remaining.empty()) {
+        vector<size_t> level, later;
+        for (size_t g : remaining) {
+            const string& table = checks[groups[g][0]].ref.referencing_table;
+            bool ready = true;
+            for (size_t x : groups[g]) {
+                const string& referenced = checks[x].ref.referenced_table;
+                if (referenced != table && pending.count(referenced) > 0) {
+                    ready = false;
+                    break;
+                }
+            }
+            (ready ? level : later).push_back(g);
+        }
+        // In a cycle, take one group at a time.
+        if (level.empty()) {
+            level.push_back(later.front());
+            later.erase(later.begin());
+        }
+        for (size_t g : level)
+            pending.erase(checks[groups[g][0]].ref.referencing_table);
+        levels->push_back(level);
+        remaining = later;
+    }
+}
+
+static void add_foreign_key_constraint(const dbtype& dbt, etymon::pgconn* conn,
+                                       ldp_log* lg, foreign_key_check* check)
+{
+    const reference& ref = check->ref;
+    // In PostgreSQL, the constraint is added without validation, and it
+    // is validated separately so that validations can run concurrently.
+    string sql =
+        "ALTER TABLE " + ref.referencing_table + "\n"
+        "    ADD CONSTRAINT\n"
+        "    " + check->constraint_name + "\n"
+        "    FOREIGN KEY (\"" + ref.referencing_column + "\")\n"
+        "    REFERENCES " + ref.referenced_table + " (" +
+        ref.referenced_column + ")" +
+        (dbt.type() == dbsys::postgresql ? "\n    NOT VALID" : "") + ";";
+    lg->detail(sql);
+    try {
+        { etymon::pgconn_result r(conn, sql); }
+        check->constrained = true;
     } catch (runtime_error& e) {
-        string s = e.what();
-        if ( !(s.empty()) && s.back() == '\n' )
-            s.pop_back();
-        lg->detail(s);
+        log_error_detail(lg, e);
     }
 }
 
-void process_foreign_keys(const ldp_options& opt, bool enable_foreign_key_warnings, bool force_foreign_key_constraints, etymon::pgconn* conn, ldp_log* lg)
+static void validate_foreign_key_constraint(etymon::pgconn* conn, ldp_log* lg,
+                                            foreign_key_check* check)
 {
-    vector<reference> refs;
-    select_enabled_foreign_keys(conn, lg, &refs);
-    for (auto& ref : refs) {
-        try {
-            string sql =
-                "CREATE TEMPORARY TABLE temp_foreign_key_exceptions AS\n"
-                "SELECT id AS referencing_pkey,\n"
-                "       \"" + ref.referencing_column + "\"\n"
-                "               AS referencing_fkey\n"
-                "    FROM " + ref.referencing_table + "\n"
-                "    WHERE \"" + ref.referencing_column + "\"\n"
-                "    NOT IN (\n"
-                "        SELECT \"" + ref.referenced_column + "\"\n"
-                "            FROM " + ref.referenced_table + "\n"
-                "    );";
+    string sql =
+        "ALTER TABLE " + check->ref.referencing_table + "\n"
+        "    VALIDATE CONSTRAINT " + check->constraint_name + ";";
+    lg->detail(sql);
+    try {
+        etymon::pgconn_result r(conn, sql);
+    } catch (runtime_error& e) {
+        check->constrained = false;
+        check->invalid = true;
+        check->validation_error = e.what();
+        if (!check->validation_error.empty() &&
+                check->validation_error.back() == '\n')
+            check->validation_error.pop_back();
+    }
+}
+
+static string reference_key(const reference& ref)
+{
+    return ref.referencing_table + "." + ref.referencing_column + " -> " +
+        ref.referenced_table + "." + ref.referenced_column;
+}
+
+/* *
+ * \brief Selects the foreign keys that were checked previously, with
+ * whether constraints were enforced.
+ */
+static void select_foreign_key_checks(etymon::pgconn* conn, ldp_log* lg,
+                                      map<string, bool>* forced)
+{
+    forced->clear();
+    string sql =
+        "SELECT referencing_table,\n"
+        "       referencing_column,\n"
+        "       referenced_table,\n"
+        "       referenced_column,\n"
+        "       forced\n"
+        "    FROM dbsystem.foreign_key_checks;";
+    lg->detail(sql);
+    etymon::pgconn_result r(conn, sql);
+    for (int x = 0; x < PQntuples(r.result); x++) {
+        reference ref;
+        ref.referencing_table = PQgetvalue(r.result, x, 0);
+        ref.referencing_column = PQgetvalue(r.result, x, 1);
+        ref.referenced_table = PQgetvalue(r.result, x, 2);
+        ref.referenced_column = PQgetvalue(r.result, x, 3);
+        (*forced)[reference_key(ref)] =
+            string(PQgetvalue(r.result, x, 4)) == "t";
+    }
+}
+
+/* *
+ * \brief Determines which references have to be checked again.
+ *
+ * A reference is checked if its referencing or referenced table was
+ * replaced, or if it was not checked previously in the same way.  When
+ * constraints are enforced, rows may be deleted from the referencing
+ * table of a reference being checked, and so references to that table
+ * are also checked.
+ */
+static void select_revalidated_foreign_keys(
+        const vector<reference>& refs, const set<string>& replaced_tables,
+        const map<string, bool>& previous_checks,
+        const set<string>& constraint_keys,
+        bool force_foreign_key_constraints, vector<char>* revalidate)
+{
+    set<string> changed = replaced_tables;
+    revalidate->assign(refs.size(), false);
+    bool grew = true;
+    while (grew) {
+        grew = false;
+        for (size_t x = 0; x < refs.size(); x++) {
+            if ((*revalidate)[x])
+                continue;
+            const reference& ref = refs[x];
+            string key = reference_key(ref);
+            auto p = previous_checks.find(key);
+            bool reuse = changed.count(ref.referencing_table) == 0 &&
+                changed.count(ref.referenced_table) == 0 &&
+                p != previous_checks.end() &&
+                p->second == force_foreign_key_constraints &&
+                ( !force_foreign_key_constraints ||
+                  constraint_keys.count(key) > 0 );
+            if (reuse)
+                continue;
+            (*revalidate)[x] = true;
+            if (force_foreign_key_constraints &&
+                    changed.insert(ref.referencing_table).second)
+                grew = true;
+        }
+    }
+}
+
+/* *
+ * \brief Reads the exceptions recorded for references that are not
+ * checked again.
+ */
+static void select_foreign_key_exceptions(etymon::pgconn* conn, ldp_log* lg,
+                                          vector<foreign_key_check>* checks)
+{
+    map<string, foreign_key_check*> check_map;
+    for (auto& check : *checks)
+        check_map[reference_key(check.ref)] = &check;
+    string sql =
+        "SELECT referencing_table,\n"
+        "       referencing_column,\n"
+        "       referenced_table,\n"
+        "       referenced_column,\n"
+        "       referencing_pkey,\n"
+        "       referencing_fkey\n"
+        "    FROM dbsystem.foreign_key_exceptions;";
+    lg->detail(sql);
+    etymon::pgconn_result r(conn, sql);
+    for (int x = 0; x < PQntuples(r.result); x++) {
+        reference ref;
+        ref.referencing_table = PQgetvalue(r.result, x, 0);
+        ref.referencing_column = PQgetvalue(r.result, x, 1);
+        ref.referenced_table = PQgetvalue(r.result, x, 2);
+        ref.referenced_column = PQgetvalue(r.result, x, 3);
+        auto c = check_map.find(reference_key(ref));
+        if (c != check_map.end())
+            c->second->exceptions.push_back({PQgetvalue(r.result, x, 4),
+                                             PQgetvalue(r.result, x, 5)});
+    }
+}
+
+/* *
+ * \brief Records the results of the references that were checked, and
+ * removes the results of references that are no longer enabled.
+ */
+static void record_foreign_key_checks(const dbtype& dbt, etymon::pgconn* conn,
+                                      ldp_log* lg,
+                                      const vector<foreign_key_check>& checks,
+                                      bool force_foreign_key_constraints)
+{
+    { etymon::pgconn_result r(conn, "BEGIN;"); }
+    for (const char* table : {"dbsystem.foreign_key_checks",
+                              "dbsystem.foreign_key_exceptions"}) {
+        string sql =
+            "DELETE FROM " + string(table) + "\n"
+            "    WHERE NOT EXISTS\n"
+            "      ( SELECT 1\n"
+            "            FROM dbconfig.foreign_keys AS f\n"
+            "            WHERE f.enable_constraint AND\n"
+            "                  f.referencing_table = " + table + ".referencing_table AND\n"
+            "                  f.referencing_column = " + table + ".referencing_column AND\n"
+            "                  f.referenced_table = " + table + ".referenced_table AND\n"
+            "                  f.referenced_column = " + table + ".referenced_column );";
+        lg->detail(sql);
+        { etymon::pgconn_result r(conn, sql); }
+    }
+    for (const auto& check : checks) {
+        const reference& ref = check.ref;
+        string columns =
+            "referencing_table, referencing_column,\n"
+            "     referenced_table, referenced_column";
+        string values =
+            "'" + ref.referencing_table + "',\n"
+            "     '" + ref.referencing_column + "',\n"
+            "     '" + ref.referenced_table + "',\n"
+            "     '" + ref.referenced_column + "'";
+        string filter =
+            "    WHERE referencing_table = '" + ref.referencing_table + "' AND\n"
+            "          referencing_column = '" + ref.referencing_column + "' AND\n"
+            "          referenced_table = '" + ref.referenced_table + "' AND\n"
+            "          referenced_column = '" + ref.referenced_column + "';";
+        for (const char* table : {"dbsystem.foreign_key_checks",
+                                  "dbsystem.foreign_key_exceptions"}) {
+            string sql = "DELETE FROM " + string(table) + "\n" + filter;
             lg->detail(sql);
             { etymon::pgconn_result r(conn, sql); }
+        }
+        string sql =
+            "INSERT INTO dbsystem.foreign_key_checks\n"
+            "    (" + columns + ",\n"
+            "     forced, exception_count, checked)\n"
+            "    VALUES\n"
+            "    (" + values + ",\n"
+            "     " + (force_foreign_key_constraints ? "TRUE" : "FALSE") +
+            ", " + to_string(check.exceptions.size()) + ", " +
+            dbt.current_timestamp() + ");";
+        lg->detail(sql);
+        { etymon::pgconn_result r(conn, sql); }
+        // Exceptions are inserted in blocks of rows.
+        size_t x = 0;
+        while (x < check.exceptions.size()) {
             sql =
-                "CREATE INDEX ON temp_foreign_key_exceptions\n"
-                "    (referencing_fkey);";
-            lg->detail(sql);
-            { etymon::pgconn_result r(conn, sql); }
-            string v;
-            vacuum_sql(opt, &v);
-            sql = v + "temp_foreign_key_exceptions;";
-            lg->detail(sql);
-            { etymon::pgconn_result r(conn, sql); }
-            sql = "ANALYZE temp_foreign_key_exceptions;";
+                "INSERT INTO dbsystem.foreign_key_exceptions\n"
+                "    (" + columns + ",\n"
+                "     referencing_pkey, referencing_fkey)\n"
+                "    VALUES\n";
+            size_t end = min(x + 1000, check.exceptions.size());
+            for (; x < end; x++) {
+                string pkey, fkey;
+                dbt.encode_string_const(check.exceptions[x].first.c_str(),
+                                        &pkey);
+                dbt.encode_string_const(check.exceptions[x].second.c_str(),
+                                        &fkey);
+                sql += "    (" + values + ",\n     " + pkey + ", " + fkey +
+                    (x + 1 < end ? "),\n" : ");");
+            }
             lg->detail(sql);
             { etymon::pgconn_result r(conn, sql); }
-        } catch (runtime_error& e) {
-            string s = e.what();
-            if ( !(s.empty()) && s.back() == '\n' )
-                s.pop_back();
-            lg->detail(s);
         }
+    }
+    { etymon::pgconn_result r(conn, "COMMIT;"); }
+}
+
+/* *
+ * \brief Reports and optionally enforces the enabled foreign keys.
+ *
+ * Only references whose tables were replaced in this update are checked
+ * again; for the others, constraints are kept in place and recorded
+ * exceptions are reported again.  References are checked concurrently
+ * over up to foreign_key_connections connections, grouped by
+ * referencing table.  When constraints are enforced, the groups are run
+ * in order of their dependencies (see order_by_dependencies()), so that
+ * the rows deleted do not depend on scheduling.  Constraints are then
+ * added one at a time, and in PostgreSQL they are validated
+ * concurrently.  Constraints that fail validation are dropped with a
+ * warning.
+ */
+void process_foreign_keys(const ldp_options& opt, bool enable_foreign_key_warnings, bool force_foreign_key_constraints, const set<string>& replaced_tables, etymon::pgconn* conn, ldp_log* lg)
+{
+    dbtype dbt(conn);
+    vector<reference> refs;
+    select_enabled_foreign_keys(conn, lg, &refs);
+    vector<reference> constraints;
+    select_foreign_key_constraints(conn, lg, &constraints);
+    set<string> constraint_keys;
+    for (const auto& c : constraints)
+        constraint_keys.insert(reference_key(c));
+    map<string, bool> previous_checks;
+    select_foreign_key_checks(conn, lg, &previous_checks);
+
+    vector<char> revalidate;
+    select_revalidated_foreign_keys(refs, replaced_tables, previous_checks,
+                                    constraint_keys,
+                                    force_foreign_key_constraints,
+                                    &revalidate);
+    vector<foreign_key_check> checks, reused;
+    set<string> reused_keys;
+    for (size_t x = 0; x < refs.size(); x++) {
+        foreign_key_check check;
+        check.ref = refs[x];
+        make_foreign_key_constraint_name(refs[x].referencing_table,
+                refs[x].referencing_column, &check.constraint_name);
+        if (revalidate[x]) {
+            checks.push_back(check);
+        } else {
+            reused_keys.insert(reference_key(check.ref));
+            reused.push_back(check);
+        }
+    }
+    lg->write(log_level::debug, "server", "",
+              "checking foreign keys: " + to_string(checks.size()) + " of " +
+              to_string(refs.size()), -1);
+
+    // Constraints are kept only for references that are not checked
+    // again.
+    vector<reference> dropped;
+    for (const auto& c : constraints) {
+        if (!force_foreign_key_constraints ||
+                reused_keys.count(reference_key(c)) == 0)
+            dropped.push_back(c);
+    }
+    drop_foreign_key_constraints(conn, lg, dropped);
+
+    // Constraints guarantee that references which are not checked
+    // again have no exceptions.
+    if (enable_foreign_key_warnings && !force_foreign_key_constraints) {
+        select_foreign_key_exceptions(conn, lg, &reused);
+        for (const auto& check : reused)
+            log_foreign_key_warnings(check, force_foreign_key_constraints,
+                                     lg);
+    }
 
-        if (enable_foreign_key_warnings)
-            log_foreign_key_warnings(ref, force_foreign_key_constraints, conn,
+    vector<vector<size_t>> groups;
+    group_by_referencing_table(checks, &groups);
+
+    vector<unique_ptr<etymon::pgconn>> pool;
+    vector<etymon::pgconn*> conns;
+    open_connection_pool(opt, lg,
+                         min((size_t) opt.foreign_key_connections,
+                             groups.size()),
+                         conn, &pool, &conns);
+
+    // Without enforcement the checks only read, and all of the groups
+    // can run at once.
+    vector<vector<size_t>> levels;
+    if (force_foreign_key_constraints) {
+        order_by_dependencies(checks, groups, &levels);
+    } else {
+        levels.push_back({});
+        for (size_t g = 0; g < groups.size(); g++)
+            levels[0].push_back(g);
+    }
+    for (const auto& level : levels) {
+        run_on_connections(conns, level.size(),
+                           [&](etymon::pgconn* c, size_t l) {
+                               for (size_t x : groups[level[l]])
+                                   check_foreign_key(
+                                       enable_foreign_key_warnings,
+                                       force_foreign_key_constraints,
+                                       c, lg, &checks[x]);
+                           });
+    }
+
+    if (enable_foreign_key_warnings) {
+        for (const auto& check : checks)
+            log_foreign_key_warnings(check, force_foreign_key_constraints,
                                      lg);
+    }
+
+    if (force_foreign_key_constraints) {
+        for (auto& check : checks)
+            add_foreign_key_constraint(dbt, conn, lg, &check);
+        if (dbt.type() == dbsys::postgresql) {
+            run_on_connections(conns, groups.size(),
+                               [&](etymon::pgconn* c, size_t g) {
+                                   for (size_t x : groups[g])
+                                       if (checks[x].constrained)
+                                           validate_foreign_key_constraint(
+                                               c, lg, &checks[x]);
+                               });
+        }
 
-        if (force_foreign_key_constraints) {
+        for (auto& check : checks) {
+            const reference& ref = check.ref;
             string sql;
             try {
+                if (check.invalid) {
+                    lg->write(log_level::warning, "foreign_key",
+                              ref.referencing_table,
+                              "Foreign key constraint could not be validated:\n"
+                              "    Referencing table: " + ref.referencing_table + "\n"
+                              "    Referencing column: " + ref.referencing_column + "\n"
+                              "    Referenced table: " + ref.referenced_table + "\n"
+                              "    Referenced column: " + ref.referenced_column + "\n"
+                              "    Error: " + check.validation_error + "\n"
+                              "    Action: Constraint dropped", -1);
+                    sql =
+                        "ALTER TABLE " + ref.referencing_table + "\n"
+                        "    DROP CONSTRAINT " + check.constraint_name + ";";
+                    lg->detail(sql);
+                    { etymon::pgconn_result r(conn, sql); }
+                }
+                if (!check.constrained)
+                    continue;
                 sql =
-                    "DELETE\n"
-                    "    FROM " + ref.referencing_table + "\n"
-                    "    WHERE \"" + ref.referencing_column + "\"\n"
-                    "    IN (\n"
-                    "        SELECT referencing_fkey\n"
-                    "            FROM temp_foreign_key_exceptions\n"
-                    "    );";
+                    "INSERT INTO dbsystem.foreign_key_constraints\n"
+                    "    (referencing_table, referencing_column,\n"
+                    "     referenced_table, referenced_column, constraint_name)\n"
+                    "    VALUES\n"
+                    "    ('" + ref.referencing_table + "',\n"
+                    "     '" + ref.referencing_column + "',\n"
+                    "     '" + ref.referenced_table + "',\n"
+                    "     '" + ref.referenced_column + "',\n"
+                    "     '" + check.constraint_name + "');";
                 lg->detail(sql);
                 { etymon::pgconn_result r(conn, sql); }
             } catch (runtime_error& e) {
-                string s = e.what();
-                if ( !(s.empty()) && s.back() == '\n' )
-                    s.pop_back();
-                lg->detail(s);
+                log_error_detail(lg, e);
             }
         }
-
-        string sql = "DROP TABLE IF EXISTS temp_foreign_key_exceptions;";
-        lg->detail(sql);
-        { etymon::pgconn_result r(conn, sql); }
-
-        if (!force_foreign_key_constraints)
-            continue;
-        
-        string constraint_name;
-        make_foreign_key_constraint_name(ref.referencing_table,
-                ref.referencing_column, &constraint_name);
-        try {
-            string sql =
-                "ALTER TABLE " + ref.referencing_table + "\n"
-                "    ADD CONSTRAINT\n"
-                "    " + constraint_name + "\n"
-                "    FOREIGN KEY (\"" + ref.referencing_column + "\")\n"
-                "    REFERENCES " + ref.referenced_table + " (" +
-                ref.referenced_column + ");";
-            lg->detail(sql);
-            { etymon::pgconn_result r(conn, sql); }
-            sql =
-                "INSERT INTO dbsystem.foreign_key_constraints\n"
-                "    (referencing_table, referencing_column,\n"
-                "     referenced_table, referenced_column, constraint_name)\n"
-                "    VALUES\n"
-                "    ('" + ref.referencing_table + "',\n"
-                "     '" + ref.referencing_column + "',\n"
-                "     '" + ref.referenced_table + "',\n"
-                "     '" + ref.referenced_column + "',\n"
-                "     '" + constraint_name + "');";
-            lg->detail(sql);
-            { etymon::pgconn_result r(conn, sql); }
-        } catch (runtime_error& e) {
-            string s = e.what();
-            if ( !(s.empty()) && s.back() == '\n' )
-                s.pop_back();
-            lg->detail(s);
-        }
     }
+
+    record_foreign_key_checks(dbt, conn, lg, checks,
+                              force_foreign_key_constraints);
 }
 
 void select_config_general(etymon::pgconn* conn, ldp_log* lg,
@@ -342,16 +821,42 @@ void select_config_general(etymon::pgconn* conn, ldp_log* lg,
     *enable_foreign_key_warnings = (s3 == "t");
 }
 
+// Checks whether the fingerprint of the staged data matches the
+// previous update, in which case the existing table can be kept.
+static bool table_unchanged(ldp_log* lg, const table_schema& table,
+                            etymon::pgconn* conn)
+{
+    if (table.fingerprint.empty())
+        return false;
+    string sql =
+        "SELECT t.fingerprint\n"
+        "    FROM dbsystem.tables AS t\n"
+        "        JOIN information_schema.tables AS i\n"
+        "            ON i.table_schema = 'public' AND\n"
+        "               i.table_name = t.table_name\n"
+        "    WHERE t.table_name = '" + table.name + "';";
+    lg->detail(sql);
+    etymon::pgconn_result r(conn, sql);
+    return PQntuples(r.result) > 0 && !PQgetisnull(r.result, 0, 0) &&
+        table.fingerprint == PQgetvalue(r.result, 0, 0);
+}
+
 bool stage_merge(const ldp_options& opt, ldp_log* lg, table_schema* table, const vector<source_state>& source_states, const string& load_dir,
-                 field_set* drop_fields)
+                 field_set* drop_fields, maintenance_scheduler* maintenance)
 {
     etymon::pgconn conn(opt.dbinfo);
     dbtype dbt(&conn);
+    apply_session_settings(opt, lg, &conn);
 
     if (opt.record_history) {
-        create_latest_history_table(opt, lg, *table, &conn);
+        convert_history_data_type(opt, lg, *table, &conn, dbt);
+        create_history_partitions(opt, lg, *table, &conn, dbt);
+        create_history_versions_view(opt, lg, *table, &conn, dbt);
     }
 
+    index_usage usage;
+    bool merged = false;
+    bool upsert = false;
     {
         char* read_buffer = (char*) malloc(varchar_size);
         etymon::malloc_ptr read_buffer_ptr(read_buffer);
@@ -359,35 +864,96 @@ bool stage_merge(const ldp_options& opt, ldp_log* lg, table_schema* table, const
         { etymon::pgconn_result r(&conn, "BEGIN;"); }
 
         lg->write(log_level::trace, "", "", table->name + ": staging", -1);
-        bool ok = stage_table_1(opt, source_states, lg, table, &conn, &dbt, load_dir, drop_fields, read_buffer);
+        bool sample = (opt.analyze_sample_percent < 100);
+        if (sample) {
+            { etymon::pgconn_result r(&conn, "SAVEPOINT stage_table;"); }
+        }
+        bool ok = stage_table_1(opt, source_states, lg, table, &conn, &dbt, load_dir, drop_fields, read_buffer, opt.analyze_sample_percent);
         if (!ok) {
             return false;
         }
 
-        ok = stage_table_2(opt, source_states, lg, table, &conn, &dbt, load_dir, drop_fields, read_buffer);
+        // Keep the existing table if the data have not changed, which
+        // skips loading, merging, indexing, and vacuuming.
+        if (table_unchanged(lg, *table, &conn)) {
+            lg->write(log_level::trace, "", "",
+                      table->name + ": unchanged", -1);
+            string loading_table;
+            loading_table_name(table->name, &loading_table);
+            drop_table(opt, lg, loading_table, &conn);
+            { etymon::pgconn_result r(&conn, "COMMIT;"); }
+            string sql =
+                "UPDATE dbsystem.tables\n"
+                "    SET updated = " + string(dbt.current_timestamp()) + ",\n"
+                "        unchanged = TRUE\n"
+                "    WHERE table_name = '" + table->name + "';";
+            lg->detail(sql);
+            { etymon::pgconn_result r(&conn, sql); }
+            return true;
+        }
+
+        try {
+            ok = stage_table_2(opt, source_states, lg, table, &conn, &dbt, load_dir, drop_fields, read_buffer);
+        } catch (sample_mismatch& e) {
+            // The sample missed a value, so analyze all of the data and
+            // load the table again.
+            lg->write(log_level::debug, "server", table->name,
+                      string(e.what()) + "\n"
+                      "    Action: Table will be analyzed without sampling", -1);
+            { etymon::pgconn_result r(&conn, "ROLLBACK TO SAVEPOINT stage_table;"); }
+            table->columns.clear();
+            ok = stage_table_1(opt, source_states, lg, table, &conn, &dbt, load_dir, drop_fields, read_buffer, 100);
+            if (!ok) {
+                return false;
+            }
+            ok = stage_table_2(opt, source_states, lg, table, &conn, &dbt, load_dir, drop_fields, read_buffer);
+        }
         if (!ok) {
             return false;
         }
 
         if (opt.record_history && table->source_type != data_source_type::srs_marc_records && table->source_type != data_source_type::srs_records) {
             lg->write(log_level::trace, "", "", table->name + ": merging", -1);
-            merge_table(opt, lg, *table, &conn, dbt);
+            size_t changed_count = 0, deleted_count = 0;
+            merge_table(opt, lg, *table, &conn, dbt, &changed_count,
+                        &deleted_count);
+            merged = true;
+            // Changes are identified by the merge, so only a merged
+            // table can be updated in place.
+            upsert = select_upsert(opt, lg, *table, changed_count,
+                                   deleted_count, &conn, dbt);
         }
 
-        remove_foreign_key_constraints(&conn, lg);
-        drop_table(opt, lg, table->name, &conn);
+        if (upsert) {
+            remove_foreign_key_constraints(&conn, lg, table->name);
+            upsert_table(opt, lg, *table, &conn, dbt);
+        } else {
+            record_index_usage(opt, lg, table->name, &conn, dbt, &usage);
+            remove_foreign_key_constraints(&conn, lg, table->name);
+            drop_table(opt, lg, table->name, &conn);
 
-        place_table(opt, lg, *table, &conn);
+            place_table(opt, lg, *table, &conn);
+        }
 
         { etymon::pgconn_result r(&conn, "COMMIT;"); }
     }
 
-    index_loaded_table(lg, *table, &conn, &dbt, opt.index_large_varchar);
-
-    if (opt.record_history) {
-        drop_latest_history_table(opt, lg, *table, &conn);
+    if (!upsert) {
+        index_loaded_table(opt, lg, *table, &conn, dbt, usage);
+        // Indexes are built while the table is still unlogged, and then
+        // written to the WAL together with the table.
+        if (opt.unlogged_loading_tables && !opt.keep_tables_unlogged &&
+                dbt.type() == dbsys::postgresql) {
+            set_table_logged(opt, lg, *table, &conn);
+        }
     }
 
+    // A replaced table is new and only needs to be analyzed, while a
+    // table updated in place and its history need to be vacuumed.
+    maintenance->schedule(table->name, upsert);
+    if (merged)
+        maintenance->schedule("history." + table->name, true);
+
     string sql =
         "SELECT COUNT(*) FROM\n"
         "    " + table->name + ";";
@@ -411,6 +977,9 @@ bool stage_merge(const ldp_options& opt, ldp_log* lg, table_schema* table, const
         "    SET updated = " + string(dbt.current_timestamp()) + ",\n"
         "        row_count = " + row_count + ",\n"
         "        history_row_count = " + history_row_count + ",\n"
+        "        fingerprint = " + (table->fingerprint.empty() ? "NULL" :
+                                    "'" + table->fingerprint + "'") + ",\n"
+        "        unchanged = FALSE,\n"
         "        documentation = '" + table->source_spec + " in "
         + table->module_name + "',\n"
         "        documentation_url = 'https://dev.folio.org/reference/api/#"
@@ -423,10 +992,11 @@ bool stage_merge(const ldp_options& opt, ldp_log* lg, table_schema* table, const
 }
 
 void run_stage_merge(const ldp_options& opt, ldp_log* lg, table_schema* table, const vector<source_state>& source_states, const string& load_dir,
-                     field_set* drop_fields)
+                     field_set* drop_fields, maintenance_scheduler* maintenance)
 {
     try {
-        stage_merge(opt, lg, table, source_states, load_dir, drop_fields);
+        stage_merge(opt, lg, table, source_states, load_dir, drop_fields,
+                    maintenance);
         exit(0);
     } catch (runtime_error& e) {
         string s = e.what();
@@ -478,6 +1048,16 @@ void run_update(const ldp_options& opt)
     lg.write(log_level::debug, "server", "", "starting update", -1);
     timer full_update_timer;
 
+    // The start time identifies tables replaced during this update.
+    string update_start;
+    {
+        etymon::pgconn conn(opt.dbinfo);
+        dbtype dbt(&conn);
+        etymon::pgconn_result r(&conn, "SELECT " +
+                                string(dbt.current_timestamp()) + ";");
+        update_start = PQgetvalue(r.result, 0, 0);
+    }
+
     lg.write(log_level::detail, "", "", "okapi timeout: " + to_string(opt.okapi_timeout), -1);
 
     ldp_schema schema;
@@ -515,6 +1095,12 @@ void run_update(const ldp_options& opt)
 
     //string current_module = "";
 
+    // Updated tables are vacuumed and analyzed by a separate process
+    // while other tables are updated.
+    maintenance_scheduler maintenance;
+    if (!opt.extract_only)
+        maintenance.start(opt, &lg);
+
     pid_t worker_pid = 0;
     string worker_table_name;
     extraction_files* worker_ext_files = nullptr;
@@ -606,7 +1192,7 @@ void run_update(const ldp_options& opt)
                 }
                 pid_t pid = fork();
                 if (pid == 0) {
-                    run_stage_merge(opt, &lg, &table, source_states, load_dir, &drop_fields);
+                    run_stage_merge(opt, &lg, &table, source_states, load_dir, &drop_fields, &maintenance);
                 }
                 if (pid < 0) {
                     throw runtime_error("error starting child process");
@@ -616,7 +1202,7 @@ void run_update(const ldp_options& opt)
                 worker_ext_files = ext_files;
             } else {  // single process
                 try {
-                    if (stage_merge(opt, &lg, &table, source_states, load_dir, &drop_fields)) {
+                    if (stage_merge(opt, &lg, &table, source_states, load_dir, &drop_fields, &maintenance)) {
                         lg.write(log_level::trace, "", table.name, table.name + ": updated", -1);
                         delete ext_files;
                     } else {
@@ -658,33 +1244,8 @@ void run_update(const ldp_options& opt)
     // Add optional columns
     add_optional_columns(opt, &lg);
 
-    // Vacuum and analyze all updated tables
-    {
-        etymon::pgconn conn(opt.dbinfo);
-        lg.write(log_level::debug, "server", "", "vacuuming", -1);
-        timer vacuum_analyze_timer;
-        string v;
-        vacuum_sql(opt, &v);
-        for (auto& table : schema.tables) {
-            if (table.skip || opt.extract_only)
-                continue;
-            string sql = v + table.name + ";";
-            lg.detail(sql);
-            { etymon::pgconn_result r(&conn, sql); }
-            sql = "ANALYZE " + table.name + ";";
-            lg.detail(sql);
-            { etymon::pgconn_result r(&conn, sql); }
-            if (opt.record_history) {
-                sql = v + "history." + table.name + ";";
-                lg.detail(sql);
-                { etymon::pgconn_result r(&conn, sql); }
-                sql = "ANALYZE history." + table.name + ";";
-                lg.detail(sql);
-                { etymon::pgconn_result r(&conn, sql); }
-            }
-        }
-        //lg.write(log_level::debug, "server", "", "completed vacuum", vacuum_analyze_timer.elapsed_time());
-    }
+    // Wait for updated tables to be vacuumed and analyzed.
+    maintenance.finish(&lg);
 
     // TODO Move analysis and constraints out of update process.
     {
@@ -713,9 +1274,7 @@ void run_update(const ldp_options& opt)
             { etymon::pgconn_result r(&conn, "BEGIN;"); }
 
             map<string, vector<reference>> refs;
-            for (auto& table : schema.tables) {
-                search_table_foreign_keys(opt, &conn, &lg, schema, table, detect_foreign_keys, &refs);
-            }
+            search_foreign_keys(opt, &lg, schema, &refs);
 
             for (pair<string, vector<reference>> p : refs) {
                 bool enable = (p.second.size() == 1);
@@ -750,11 +1309,30 @@ void run_update(const ldp_options& opt)
 
             timer ref_timer;
 
-            process_foreign_keys(opt, enable_foreign_key_warnings, force_foreign_key_constraints, &conn, &lg);
+            set<string> replaced_tables;
+            sql =
+                "SELECT table_name\n"
+                "    FROM dbsystem.tables\n"
+                "    WHERE updated >= '" + update_start + "' AND\n"
+                "          NOT unchanged;";
+            lg.detail(sql);
+            {
+                etymon::pgconn_result r(&conn, sql);
+                for (int x = 0; x < PQntuples(r.result); x++)
+                    replaced_tables.insert(PQgetvalue(r.result, x, 0));
+            }
+
+            process_foreign_keys(opt, enable_foreign_key_warnings, force_foreign_key_constraints, replaced_tables, &conn, &lg);
 
             lg.write(log_level::debug, "server", "",
                     "completed foreign key constraint processing",
                     ref_timer.elapsed_time());
+        } else {
+            // Constraints are kept between updates only while they are
+            // enforced.
+            vector<reference> constraints;
+            select_foreign_key_constraints(&conn, &lg, &constraints);
+            drop_foreign_key_constraints(&conn, &lg, constraints);
         }
 
     }
@@ -1,55 +1,91 @@
+#include <atomic>
 #include <cstring>
+#include <stdexcept>
+#include <thread>
 
 #include "util.h"
 
-bool is_uuid(const char* str)
+void vacuum_sql(const ldp_options& opt, string* sql)
+{
+    if (opt.parallel_vacuum) {
+        *sql = "VACUUM ";
+    } else {
+        *sql = "VACUUM (PARALLEL 0) ";
+    }
+}
+
+/* *
+ * \brief Applies the configured session settings to a connection used
+ * for loading data, e.g. synchronous_commit or maintenance_work_mem.
+ */
+void apply_session_settings(const ldp_options& opt, ldp_log* lg,
+                            etymon::pgconn* conn)
 {
-    if (strlen(str) != 36)
-        return false;
-    for (int x = 0; x < 36; x++) {
-        char c = str[x];
-        if (x == 8 || x == 13 || x == 18 || x == 23) {
-            if (c != '-')
-                return false;
-        } else {
-            switch (c) {
-            case '0':
-            case '1':
-            case '2':
-            case '3':
-            case '4':
-            case '5':
-            case '6':
-            case '7':
-            case '8':
-            case '9':
-            case 'A':
-            case 'B':
-            case 'C':
-            case 'D':
-            case 'E':
-            case 'F':
-            case 'a':
-            case 'b':
-            case 'c':
-            case 'd':
-            case 'e':
-            case 'f':
-                break;
-            default:
-                return false;
-            }
+    dbtype dbt(conn);
+    if (dbt.type() != dbsys::postgresql)
+        return;
+    for (const auto& [name, value] : opt.session_settings) {
+        string name_const, value_const;
+        dbt.encode_string_const(name.c_str(), &name_const);
+        dbt.encode_string_const(value.c_str(), &value_const);
+        string sql = "SELECT set_config(" + name_const + ", " + value_const +
+            ", FALSE);";
+        lg->detail(sql);
+        { etymon::pgconn_result r(conn, sql); }
+    }
+}
+
+/* *
+ * \brief Opens a pool of up to size connections including the given
+ * one, using fewer if the server refuses them.
+ *
+ * The additional connections are owned by pool, and conns lists all of
+ * the connections starting with conn.
+ */
+void open_connection_pool(const ldp_options& opt, ldp_log* lg,
+                          size_t size, etymon::pgconn* conn,
+                          vector<unique_ptr<etymon::pgconn>>* pool,
+                          vector<etymon::pgconn*>* conns)
+{
+    pool->clear();
+    while (pool->size() + 1 < size) {
+        try {
+            pool->push_back(make_unique<etymon::pgconn>(opt.dbinfo));
+        } catch (runtime_error& e) {
+            lg->write(log_level::debug, "server", "",
+                      "Unable to open additional connection: " +
+                      string(e.what()), -1);
+            break;
         }
+        apply_session_settings(opt, lg, pool->back().get());
     }
-    return true;
+    *conns = {conn};
+    for (auto& c : *pool)
+        conns->push_back(c.get());
 }
 
-void vacuum_sql(const ldp_options& opt, string* sql)
+/* *
+ * \brief Runs tasks numbered 0 to task_count - 1, with each connection
+ * on its own thread taking the next task until none remain.
+ */
+void run_on_connections(const vector<etymon::pgconn*>& conns,
+                        size_t task_count,
+                        const function<void(etymon::pgconn*, size_t)>& task)
 {
-    if (opt.parallel_vacuum) {
-        *sql = "VACUUM ";
+    atomic<size_t> next(0);
+    auto worker = [&](etymon::pgconn* c) {
+        size_t x;
+        while ((x = next++) < task_count)
+            task(c, x);
+    };
+    if (conns.size() == 1) {
+        worker(conns[0]);
     } else {
-        *sql = "VACUUM (PARALLEL 0) ";
+        vector<thread> threads;
+        for (auto c : conns)
+            threads.emplace_back(worker, c);
+        for (auto& t : threads)
+            t.join();
     }
 }
 
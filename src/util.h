@@ -1,14 +1,28 @@
 #ifndef LDP_UTIL_H
 #define LDP_UTIL_H
 
+#include <functional>
+#include <memory>
+#include <vector>
+
 #include "options.h"
 
 constexpr long unsigned int varchar_size = 67108864;
 
-bool is_uuid(const char* str);
-
 void vacuum_sql(const ldp_options& opt, string* sql);
 
+void apply_session_settings(const ldp_options& opt, ldp_log* lg,
+                            etymon::pgconn* conn);
+
+void open_connection_pool(const ldp_options& opt, ldp_log* lg,
+                          size_t size, etymon::pgconn* conn,
+                          vector<unique_ptr<etymon::pgconn>>* pool,
+                          vector<etymon::pgconn*>* conns);
+
+void run_on_connections(const vector<etymon::pgconn*>& conns,
+                        size_t task_count,
+                        const function<void(etymon::pgconn*, size_t)>& task);
+
 void print_banner_line(FILE* stream, char ch, int width);
 
 class source_state {
@@ -0,0 +1,87 @@
+#include <random>
+#include <string>
+
+#include "test.h"
+#include "../src/dbtype.h"
+
+// Previous implementation of dbtype::encode_copy(), kept as a reference.
+static void old_encode_copy(const char* str, string* newstr)
+{
+    newstr->clear();
+    const char *p = str;
+    char c;
+    while ( (c=*p) != '\0') {
+        switch (c) {
+            case '\\':
+                *newstr += "\\\\";
+                break;
+            case '\b':
+                *newstr += "\\b";
+                break;
+            case '\f':
+                *newstr += "\\f";
+                break;
+            case '\n':
+                *newstr += "\\n";
+                break;
+            case '\r':
+                *newstr += "\\r";
+                break;
+            case '\t':
+                *newstr += "\\t";
+                break;
+            case '\v':
+                *newstr += "\\v";
+                break;
+            default:
+                *newstr += c;
+        }
+        p++;
+    }
+}
+
+TEST_CASE( "Encode strings in COPY text format", "[dbtype]" ) {
+    dbtype dbt(nullptr);
+    vector<pair<string, string>> tests = {
+        {"", ""},
+        {"a", "a"},
+        {"\\", "\\\\"},
+        {"a\bb\fc\nd\re\tf\vg", "a\\bb\\fc\\nd\\re\\tf\\vg"},
+        {"\x07\x0e\x1b", "\x07\x0e\x1b"},
+        {"{\n    \"id\": \"a\\\"b\"\n}", "{\\n    \"id\": \"a\\\\\"b\"\\n}"},
+        {string("abc\0def", 7), "abc"}
+    };
+    for (auto& t : tests) {
+        string s = "prefix";
+        dbt.encode_copy_append(t.first.data(), t.first.length(), &s);
+        CHECK( s == "prefix" + t.second );
+    }
+}
+
+TEST_CASE( "Compare COPY encoding with previous encoder", "[dbtype]" ) {
+    dbtype dbt(nullptr);
+    mt19937 gen(1);
+    string alphabet = "abcdefghij \"{}:,\\\b\f\n\r\t\v\x07\x0e\x7f\x80\xff";
+    uniform_int_distribution<size_t> ch(0, alphabet.length() - 1);
+    uniform_int_distribution<int> density(1, 100);
+    uniform_int_distribution<size_t> len(0, 200);
+    for (int x = 0; x < 20000; x++) {
+        // Vary the density of special characters, so that long clean
+        // runs and block boundaries are exercised.
+        int d = density(gen);
+        size_t n = len(gen);
+        string str;
+        for (size_t y = 0; y < n; y++) {
+            char c = alphabet[ch(gen)];
+            str += (density(gen) <= d ? c : 'x');
+        }
+        if (x % 50 == 0 && n > 0)
+            str[len(gen) % n] = '\0';
+        string expected, encoded, appended = "prefix";
+        old_encode_copy(str.c_str(), &expected);
+        dbt.encode_copy(str.c_str(), &encoded);
+        dbt.encode_copy_append(str.data(), str.length(), &appended);
+        CHECK( encoded == expected );
+        CHECK( appended == "prefix" + expected );
+    }
+}
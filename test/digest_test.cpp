@@ -0,0 +1,84 @@
+#include <algorithm>
+#include <random>
+#include <string>
+
+#include "test.h"
+#include "../src/digest.h"
+
+TEST_CASE( "Compute MD5 digests", "[digest]" ) {
+    // Test suite from RFC 1321
+    vector<pair<string, string>> tests = {
+        {"", "d41d8cd98f00b204e9800998ecf8427e"},
+        {"a", "0cc175b9c0f1b6a831c399e269772661"},
+        {"abc", "900150983cd24fb0d6963f7d28e17f72"},
+        {"message digest", "f96b697d7cb7938d525a2f31aaf161d0"},
+        {"abcdefghijklmnopqrstuvwxyz", "c3fcd3d76192e4007dfb496cca67e13b"},
+        {"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789",
+            "d174ab98d277d9f5a5611c2c9f419d9f"},
+        {"1234567890123456789012345678901234567890"
+            "1234567890123456789012345678901234567890",
+            "57edf4a22be3c955ac49da2e2107b67a"}
+    };
+    record_digest digest;
+    for (auto& t : tests) {
+        string hex;
+        digest.reset();
+        digest.update(t.first.data(), t.first.length());
+        digest.finish(&hex);
+        CHECK( hex == t.second );
+        // The same digest computed one character at a time
+        digest.reset();
+        for (char c : t.first)
+            digest.put(c);
+        digest.finish(&hex);
+        CHECK( hex == t.second );
+    }
+}
+
+static void fingerprint_records(const vector<string>& records, string* str)
+{
+    table_fingerprint fingerprint;
+    record_digest digest;
+    for (const string& r : records) {
+        uint8_t d[16];
+        digest.reset();
+        digest.update(r.data(), r.length());
+        digest.finish(d);
+        fingerprint.add(d);
+    }
+    fingerprint.finish(str);
+}
+
+TEST_CASE( "Compute table fingerprints", "[digest]" ) {
+    vector<string> records;
+    for (int x = 0; x < 1000; x++)
+        records.push_back("{\"id\": \"" + to_string(x) + "\"}");
+    string expected;
+    fingerprint_records(records, &expected);
+    CHECK( expected.length() == 32 + 5 );
+    CHECK( expected.substr(32) == ":1000" );
+
+    // Independent of order
+    mt19937 gen(1);
+    for (int x = 0; x < 10; x++) {
+        shuffle(records.begin(), records.end(), gen);
+        string fp;
+        fingerprint_records(records, &fp);
+        CHECK( fp == expected );
+    }
+
+    // Changed, removed, and duplicated records
+    string fp;
+    vector<string> changed = records;
+    changed[500] += " ";
+    fingerprint_records(changed, &fp);
+    CHECK( fp != expected );
+    changed = records;
+    changed.pop_back();
+    fingerprint_records(changed, &fp);
+    CHECK( fp != expected );
+    changed = records;
+    changed[1] = changed[0];
+    fingerprint_records(changed, &fp);
+    CHECK( fp != expected );
+}
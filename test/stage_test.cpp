@@ -0,0 +1,129 @@
+#include <cstdio>
+#include <set>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "test.h"
+#include "../src/stage.h"
+
+TEST_CASE( "Detect fields missing from sampled pages", "[stage]" ) {
+    // Top-level fields present in each page of the source data; "late"
+    // first appears in a page that is skipped by sampling.
+    vector<vector<string>> pages = {
+        {"id", "name"},
+        {"id", "name", "late"},
+        {"id", "name"},
+        {"id", "name", "dropped"},
+        {"id", "name", "tail"}
+    };
+    int sample_percent = 50;
+    size_t page_count = pages.size();
+
+    table_schema table;
+    table.name = "test_table";
+    table.source_type = data_source_type::rmb;
+    set<string> sampled_fields;
+    for (size_t page = 0; page < page_count; page++) {
+        if (!sample_page(page, page_count, sample_percent)) {
+            table.sampled = true;
+            continue;
+        }
+        for (auto& field : pages[page])
+            sampled_fields.insert(field);
+    }
+    for (auto& field : sampled_fields) {
+        column_schema column;
+        column.name = field;
+        column.source_name = field;
+        table.columns.push_back(column);
+    }
+
+    REQUIRE( table.sampled );
+    CHECK( sample_page(0, page_count, sample_percent) );
+    CHECK( !sample_page(1, page_count, sample_percent) );
+    CHECK( sample_page(page_count - 1, page_count, sample_percent) );
+
+    field_node drop_fields;
+    field_node dropped;
+    dropped.name = "dropped";
+    dropped.match = true;
+    drop_fields.children.push_back(dropped);
+
+    unordered_set<string_view> columns;
+    column_source_names(table, &columns);
+    CHECK( columns.size() == table.columns.size() );
+
+    for (size_t page = 0; page < page_count; page++) {
+        for (auto& field : pages[page]) {
+            bool unsampled = is_unsampled_field(columns, &drop_fields,
+                                                field.data(), field.length());
+            CHECK( unsampled == (field == "late") );
+        }
+    }
+    string late = "late";
+    CHECK( is_unsampled_field(columns, nullptr, late.data(), late.length()) );
+    // A dropped field is only excused by the filter.
+    string dropped_name = "dropped";
+    CHECK( is_unsampled_field(columns, nullptr, dropped_name.data(),
+                              dropped_name.length()) );
+
+    // Sampling is disabled at 100 percent.
+    for (size_t page = 0; page < page_count; page++)
+        CHECK( sample_page(page, page_count, 100) );
+}
+
+TEST_CASE( "Create columns only for scalar top-level fields", "[stage]" ) {
+    char path[] = "/tmp/ldp_stage_test_XXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE( fd != -1 );
+    FILE* fp = fdopen(fd, "w");
+    REQUIRE( fp != nullptr );
+    fputs("{\n"
+          "  \"things\": [\n"
+          "    {\n"
+          "      \"id\": \"2b94c631-fca9-4892-a730-03ee529ffe2a\",\n"
+          "      \"name\": \"first\",\n"
+          "      \"count\": 3,\n"
+          "      \"note\": null,\n"
+          "      \"metadata\": {\n"
+          "        \"createdDate\": \"2020-01-01T00:00:00.000+0000\"\n"
+          "      },\n"
+          "      \"tags\": [ \"a\", \"b\" ]\n"
+          "    },\n"
+          "    {\n"
+          "      \"id\": \"c3b0ff92-e9ef-4e3a-ab61-0a2e3ca3bd5d\",\n"
+          "      \"name\": \"second\",\n"
+          "      \"metadata\": {},\n"
+          "      \"tags\": []\n"
+          "    }\n"
+          "  ],\n"
+          "  \"totalRecords\": 2\n"
+          "}\n", fp);
+    fclose(fp);
+
+    ldp_options opt;
+    table_schema table;
+    table.name = "test_table";
+    table.source_type = data_source_type::rmb;
+    field_set drop_fields;
+    type_statistics type_stats;
+    analyze_page(opt, table, drop_fields, path, &type_stats);
+    unlink(path);
+
+    map<string,type_counts> stats;
+    type_stats.sorted_counts(&stats);
+    ldp_log lg(nullptr, log_level::warning, false, true);
+    REQUIRE( select_columns(&lg, stats, &table) );
+
+    map<string, column_type> columns;
+    for (const auto& column : table.columns)
+        columns[column.source_name] = column.type;
+    CHECK( columns.size() == 4 );
+    CHECK( columns["id"] == column_type::id );
+    CHECK( columns["name"] == column_type::varchar );
+    CHECK( columns["count"] == column_type::bigint );
+    CHECK( columns.count("note") == 1 );
+    CHECK( columns.count("metadata") == 0 );
+    CHECK( columns.count("tags") == 0 );
+}
@@ -0,0 +1,126 @@
+#include <cstring>
+#include <random>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include "test.h"
+#include "../src/strclass.h"
+
+// Previous implementations, kept as references for equivalence tests and
+// benchmarks.
+
+static bool old_is_uuid(const char* str)
+{
+    if (strlen(str) != 36)
+        return false;
+    for (int x = 0; x < 36; x++) {
+        char c = str[x];
+        if (x == 8 || x == 13 || x == 18 || x == 23) {
+            if (c != '-')
+                return false;
+        } else {
+            if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') ||
+                        (c >= 'A' && c <= 'F')))
+                return false;
+        }
+    }
+    return true;
+}
+
+static bool old_looks_like_date_time(const char* str)
+{
+    static regex date_time("^\\d{4}-\\d{2}-\\d{2}T\\d{2}:\\d{2}:\\d{2}");
+    return regex_search(str, date_time);
+}
+
+static vector<string> sample_strings()
+{
+    vector<string> v = {
+        "",
+        "a",
+        "00000000-0000-0000-0000-000000000000",
+        "5bf370f2-1c2c-4cb5-9b4c-2a6d8c3e3f2e",
+        "5BF370F2-1C2C-4CB5-9B4C-2A6D8C3E3F2E",
+        "5bf370f2-1c2c-4cb5-9b4c-2a6d8c3e3f2",
+        "5bf370f2-1c2c-4cb5-9b4c-2a6d8c3e3f2e0",
+        "5bf370f2x1c2c-4cb5-9b4c-2a6d8c3e3f2e",
+        "5bf370f2-1c2c-4cb5-9b4c-2a6d8c3e3f2g",
+        "gbf370f2-1c2c-4cb5-9b4c-2a6d8c3e3f2e",
+        "5bf370f2-1c2c-4cb5-9b4c-2a6d8c3e3f:e",
+        "5bf370f2-1c2c-4cb5-9b4c-2a6d8c3e3f@e",
+        "5bf370f2-1c2c-4cb5-9b4c-2a6d8c3e3f`e",
+        "5bf370f21c2c-4cb5-9b4c-2a6d8c3e3f2e-",
+        "2020-01-31T23:59:59",
+        "2020-01-31T23:59:59.000+0000",
+        "2020-01-31T23:59:5",
+        "2020-01-31 23:59:59",
+        "2020/01/31T23:59:59",
+        "x2020-01-31T23:59:59",
+        "2020-01-31T23:59:5a",
+        "0000-00-00T00:00:00Z",
+        "The quick brown fox jumps over the lazy dog"
+    };
+    // Random mutations of valid strings
+    mt19937 gen(1);
+    string alphabet = "0123456789abcdefABCDEFgG-:T /\x7f\x80\xff";
+    uniform_int_distribution<size_t> ch(0, alphabet.length() - 1);
+    for (int x = 0; x < 10000; x++) {
+        string s = (x % 2 == 0 ? v[3] : v[15]);
+        uniform_int_distribution<size_t> pos(0, s.length() - 1);
+        s[pos(gen)] = alphabet[ch(gen)];
+        if (x % 7 == 0)
+            s.erase(pos(gen));
+        v.push_back(s);
+    }
+    return v;
+}
+
+TEST_CASE( "Classify strings", "[strclass]" ) {
+    for (const string& s : sample_strings()) {
+        string_class cls, scalar;
+        classify_string(s.c_str(), s.length(), &cls);
+        classify_string_scalar(s.c_str(), s.length(), &scalar);
+        INFO( s );
+        CHECK( cls.uuid == old_is_uuid(s.c_str()) );
+        CHECK( cls.date_time == old_looks_like_date_time(s.c_str()) );
+        CHECK( cls.length == s.length() );
+        CHECK( scalar.uuid == cls.uuid );
+        CHECK( scalar.date_time == cls.date_time );
+        CHECK( scalar.length == cls.length );
+    }
+}
+
+TEST_CASE( "Benchmark string classification", "[.][benchmark][strclass]" ) {
+    vector<string> v = sample_strings();
+
+    BENCHMARK( "old is_uuid and looks_like_date_time" ) {
+        size_t n = 0;
+        for (const string& s : v) {
+            n += old_is_uuid(s.c_str());
+            n += old_looks_like_date_time(s.c_str());
+            n += strlen(s.c_str());
+        }
+        return n;
+    };
+
+    BENCHMARK( "classify_string_scalar" ) {
+        size_t n = 0;
+        for (const string& s : v) {
+            string_class cls;
+            classify_string_scalar(s.c_str(), s.length(), &cls);
+            n += cls.uuid + cls.date_time + cls.length;
+        }
+        return n;
+    };
+
+    BENCHMARK( "classify_string" ) {
+        size_t n = 0;
+        for (const string& s : v) {
+            string_class cls;
+            classify_string(s.c_str(), s.length(), &cls);
+            n += cls.uuid + cls.date_time + cls.length;
+        }
+        return n;
+    };
+}